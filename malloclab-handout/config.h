@@ -53,15 +53,32 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (either 4, 8 or 16). 64-bit systems
+ * need 16 bytes, the alignment of max_align_t (and of SSE types).
  */
+#if __SIZEOF_POINTER__ == 8
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8  
+#endif
 
 /* 
  * Maximum heap size in bytes 
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Set USE_VMEM to "1" to back the heap with real virtual memory: memlib
+ * then reserves VMEM_RESERVE bytes of address space up front, commits
+ * pages as mem_sbrk grows the heap (and decommits them as it shrinks),
+ * and mem_purge gives free pages back to the system. Otherwise the heap
+ * is a block of MAX_HEAP bytes from malloc, and mem_purge does nothing.
+ */
+#ifndef USE_VMEM
+#define USE_VMEM 0
+#endif
+#define VMEM_RESERVE (256*(1<<20))  /* 256 MB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
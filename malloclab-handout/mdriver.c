@@ -15,6 +15,11 @@
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
+#if MM_THREADS
+#include <pthread.h>
+#include <sys/time.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
@@ -30,8 +35,18 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* The kinds of requests that -L reports the worst-case latency of */
+#define LAT_MALLOC   0 /* malloc, memalign, calloc and malloc_batch */
+#define LAT_REALLOC  1 /* realloc */
+#define LAT_FREE     2 /* free, free_sized and free_batch */
+#define LAT_KINDS    3
+#define LAT_RUNS     3 /* runs per trace */
+
+/* The number of call sites that an alloc request can name (1 to SITES) */
+#define SITES        8
+
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
@@ -46,9 +61,13 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, MEMALIGN, CALLOC,
+	  ALLOC_BATCH, FREE_BATCH, FREE_SIZED} type; /* type of request */
     int index;                        /* index for free() to use later */
     int size;                         /* byte size of alloc/realloc request */
+    int align;                        /* alignment of memalign request */
+    int count;                        /* number of ids (from index on) in a batch */
+    int site;                         /* call site of alloc request (0 if none) */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -81,6 +100,8 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    unsigned predicted; /* lifetime predictions checked while measuring util */
+    unsigned right;     /* ... and how many of them were right */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
@@ -100,6 +121,49 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The mm package under test (the one in mm.c, unless comparing policies) */
+static const mm_ops_t mm_default = {
+    "mm", mm_init, mm_malloc, mm_free, mm_free_sized, mm_calloc, mm_realloc,
+    mm_memalign, mm_malloc_batch, mm_free_batch, mm_trim, mm_predictions
+};
+static const mm_ops_t *mm = &mm_default;
+
+/*
+ * The call sites that alloc requests can name. Each calls mm_malloc
+ * from a call instruction of its own, and does not return its result
+ * right away (so the call is not turned into a jump), so that a package
+ * that looks at the return address of mm_malloc tells them apart.
+ */
+static volatile int last_site;
+
+#define SITE_MALLOC(n) \
+static void *site_malloc##n(size_t size) \
+{ \
+    void *p = mm->malloc(size); \
+    last_site = n; \
+    return p; \
+}
+
+SITE_MALLOC(1) SITE_MALLOC(2) SITE_MALLOC(3) SITE_MALLOC(4)
+SITE_MALLOC(5) SITE_MALLOC(6) SITE_MALLOC(7) SITE_MALLOC(8)
+
+static void *(*site_mallocs[SITES])(size_t size) = {
+    site_malloc1, site_malloc2, site_malloc3, site_malloc4,
+    site_malloc5, site_malloc6, site_malloc7, site_malloc8
+};
+
+/* Calls mm_malloc from the call site of the given alloc request */
+#define OP_MALLOC(op, size) \
+    ((op)->site > 0 ? site_mallocs[(op)->site - 1](size) : mm->malloc(size))
+
+#if MM_POLICIES
+/* The builds of mm.c with each placement policy (see the Makefile) */
+extern const mm_ops_t next_mm_ops, best_mm_ops, good_mm_ops, tlsf_mm_ops;
+static const mm_ops_t *mm_policies[] = {
+    &mm_ops, &next_mm_ops, &best_mm_ops, &good_mm_ops, &tlsf_mm_ops, NULL
+};
+#endif
+
 
 /********************* 
  * Function prototypes 
@@ -121,11 +185,23 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, double *worst, double *best);
+#if MM_POLICIES
+static void max_latency(char **tracefiles, int num_tracefiles, 
+			stats_t *stats, double *worst);
+#endif
+#if MM_THREADS
+static double eval_mm_threads(trace_t *trace, int nthreads);
+static void *replay_trace(void *ptr);
+#endif
 
 /* Various helper routines */
+static double perf_index(double avg_util, double avg_throughput,
+			 double *p1, double *p2);
 static void printresults(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
@@ -142,7 +218,6 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,6 +225,15 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int latency = 0;     /* If set, report worst-case latencies (-L) */
+    double worst[LAT_KINDS]; /* worst-case latencies in ns over all traces */
+    int predictions = 0; /* If set, report lifetime predictions (-S) */
+#if MM_POLICIES
+    int policies = 0;    /* If set, compare the placement policies (-P) */
+#endif
+#if MM_THREADS
+    int nthreads = 0;    /* If set, measure throughput with this many threads (-T) */
+#endif
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +242,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:T:hvVgalLPS")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,12 +262,34 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'T': /* Replay each trace in this many threads at once */
+#if MM_THREADS
+            nthreads = atoi(optarg);
+            break;
+#else
+            printf("ERROR: -T requires a build with THREADS=1\n");
+            exit(1);
+#endif
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Report the worst-case latency of each kind of request */
+            latency = 1;
+            break;
+        case 'S': /* Report how many lifetime predictions were right */
+            predictions = 1;
+            break;
+        case 'P': /* Compare the builds of every placement policy */
+#if MM_POLICIES
+            policies = 1;
+            break;
+#else
+            printf("ERROR: -P requires a build with POLICIES=1\n");
+            exit(1);
+#endif
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -273,12 +379,6 @@ int main(int argc, char **argv)
 	}
     }
 
-    /*
-     * Always run and evaluate the student's mm package
-     */
-    if (verbose > 1)
-	printf("\nTesting mm malloc\n");
-
     /* Allocate the mm stats array, with one stats_t struct per tracefile */
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
@@ -287,25 +387,64 @@ int main(int argc, char **argv)
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
-    /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+#if MM_POLICIES
+    /*
+     * Optionally evaluate the build of every placement policy, and
+     * print their aggregate results side by side
+     */
+    if (policies) {
+	int j;
+
+	printf("%-10s%6s%8s%10s%8s%6s",
+	       "policy", "util", "ops", "secs", "Kops", "perf");
+	if (latency)
+	    printf("%11s%11s%11s", "malloc ns", "realloc ns", "free ns");
+	printf("\n");
+	for (i=0; mm_policies[i] != NULL; i++) {
+	    mm = mm_policies[i];
+	    errors = 0;
+	    eval_mm(tracefiles, num_tracefiles, mm_stats);
+	    if (verbose) {
+		printf("\nResults for %s:\n", mm->name);
+		printresults(num_tracefiles, mm_stats);
+		printf("\n");
+	    }
+
+	    secs = 0;
+	    ops = 0;
+	    util = 0;
+	    for (j=0; j < num_tracefiles; j++) {
+		secs += mm_stats[j].secs;
+		ops += mm_stats[j].ops;
+		util += mm_stats[j].util;
+	    }
+
+	    if (errors == 0) {
+		printf("%-10s%5.0f%%%8.0f%10.6f%8.0f%6.0f", mm->name,
+		       util/num_tracefiles*100.0, ops, secs, ops/1e3/secs,
+		       perf_index(util/num_tracefiles, ops/secs, &p1, &p2));
+		if (latency) {
+		    max_latency(tracefiles, num_tracefiles, mm_stats, worst);
+		    printf("%11.0f%11.0f%11.0f", worst[LAT_MALLOC],
+			   worst[LAT_REALLOC], worst[LAT_FREE]);
+		}
+		printf("\n");
+	    }
+	    else
+		printf("%-10s  terminated with %d errors\n", mm->name, errors);
 	}
-	free_trace(trace);
+	exit(0);
     }
+#endif
+
+    /*
+     * Always run and evaluate the student's mm package
+     */
+    if (verbose > 1)
+	printf("\nTesting mm malloc\n");
+
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    eval_mm(tracefiles, num_tracefiles, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -314,6 +453,89 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /*
+     * Optionally print how many of the lifetime predictions that were
+     * checked while the utilization was measured turned out right
+     */
+    if (predictions) {
+	printf("Lifetime predictions:\n");
+	printf("%5s%11s%8s%10s%7s\n", "trace", "predicted", "right",
+	       "accuracy", "util");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    printf("%2d%14u%8u%9.0f%%%6.0f%%\n", i, mm_stats[i].predicted,
+		   mm_stats[i].right, mm_stats[i].predicted == 0 ? 0.0 :
+		   100.0*mm_stats[i].right/mm_stats[i].predicted,
+		   mm_stats[i].util*100.0);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay every trace with each request timed on its own,
+     * and print the slowest request of each kind (over all runs, and in
+     * the run in which it was fastest)
+     */
+    if (latency) {
+	double lat[LAT_KINDS], best[LAT_KINDS], best_max[LAT_KINDS];
+	int kind;
+
+	printf("Worst-case latency in ns over %d runs (and in the best run):\n",
+	       LAT_RUNS);
+	printf("%5s%10s%8s%10s%8s%10s%8s\n", "trace", "malloc", "(best)",
+	       "realloc", "(best)", "free", "(best)");
+	for (kind = 0; kind < LAT_KINDS; kind++) {
+	    worst[kind] = 0;
+	    best_max[kind] = 0;
+	}
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_latency(trace, lat, best);
+	    printf("%2d%13.0f%8.0f%10.0f%8.0f%10.0f%8.0f\n", i,
+		   lat[LAT_MALLOC], best[LAT_MALLOC], lat[LAT_REALLOC],
+		   best[LAT_REALLOC], lat[LAT_FREE], best[LAT_FREE]);
+	    for (kind = 0; kind < LAT_KINDS; kind++) {
+		if (lat[kind] > worst[kind])
+		    worst[kind] = lat[kind];
+		if (best[kind] > best_max[kind])
+		    best_max[kind] = best[kind];
+	    }
+	    free_trace(trace);
+	}
+	printf("%-5s%10.0f%8.0f%10.0f%8.0f%10.0f%8.0f\n\n", "Max",
+	       worst[LAT_MALLOC], best_max[LAT_MALLOC], worst[LAT_REALLOC],
+	       best_max[LAT_REALLOC], worst[LAT_FREE], best_max[LAT_FREE]);
+    }
+
+#if MM_THREADS
+    /*
+     * Optionally compare the throughput of a single thread with that of
+     * nthreads threads that each replay their own copy of the trace
+     */
+    if (nthreads > 0) {
+	printf("Throughput with 1 and %d threads:\n", nthreads);
+	printf("%5s%10s%12s%12s%9s\n", "trace", " ops", "Kops (1)", "Kops (n)", "speedup");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    secs = eval_mm_threads(trace, 1);
+	    p1 = eval_mm_threads(trace, nthreads);
+	    if (secs < 0 || p1 < 0)
+		printf("%2d%15.0f  out of memory\n", i, mm_stats[i].ops);
+	    else
+		printf("%2d%15.0f%12.0f%12.0f%9.2f\n", i, mm_stats[i].ops,
+		       mm_stats[i].ops/1e3/secs, nthreads*mm_stats[i].ops/1e3/p1,
+		       nthreads*secs/p1);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+#endif
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -335,17 +557,7 @@ int main(int argc, char **argv)
      */
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
-
-	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
-	    p2 = (double)(1.0 - UTIL_WEIGHT);
-	} 
-	else {
-	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
-	}
-	
-	perfindex = (p1 + p2)*100.0;
+	perfindex = perf_index(avg_mm_util, avg_mm_throughput, &p1, &p2);
 	printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
 	       p1*100, 
 	       p2*100, 
@@ -395,9 +607,10 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap (or a mapped region) */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -477,7 +690,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
+    char line[MAXLINE];
+    unsigned index, size, align, count, site;
     unsigned max_index = 0;
     unsigned op_index;
 
@@ -520,11 +734,19 @@ static trace_t *read_trace(char *tracedir, char *filename)
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
 	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
+	case 'a': /* the call site is optional */
+	    site = 0;
+	    fgets(line, MAXLINE, tracefile);
+	    sscanf(line, "%u %u %u", &index, &size, &site);
+	    if (site > SITES) {
+		sprintf(msg, "Call site %u in tracefile %s is not below %d",
+			site, path, SITES + 1);
+		app_error(msg);
+	    }
 	    trace->ops[op_index].type = ALLOC;
 	    trace->ops[op_index].index = index;
 	    trace->ops[op_index].size = size;
+	    trace->ops[op_index].site = site;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
 	case 'r':
@@ -534,11 +756,45 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
+	case 'm':
+	    fscanf(tracefile, "%u %u %u", &index, &align, &size);
+	    trace->ops[op_index].type = MEMALIGN;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].align = align;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'c':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	case 'f':
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
 	    break;
+	case 's':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE_SIZED;
+	    trace->ops[op_index].index = index;
+	    break;
+	case 'A':
+	    fscanf(tracefile, "%u %u %u", &index, &count, &size);
+	    trace->ops[op_index].type = ALLOC_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    trace->ops[op_index].size = size;
+	    max_index = (index + count - 1 > max_index) ? index + count - 1 : max_index;
+	    break;
+	case 'F':
+	    fscanf(tracefile, "%u %u", &index, &count);
+	    trace->ops[op_index].type = FREE_BATCH;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].count = count;
+	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
 		   type[0], path);
@@ -571,6 +827,43 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_mm - Evaluates the mm package (correctness, space utilization
+ *     and throughput) on every trace, with one stats_t struct per trace
+ */
+static void eval_mm(char **tracefiles, int num_tracefiles, stats_t *stats)
+{
+    int i;
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+
+    for (i=0; i < num_tracefiles; i++) {
+	trace = read_trace(tracedir, tracefiles[i]);
+	stats[i].ops = trace->num_ops;
+	if (verbose > 1)
+	    printf("Checking mm_malloc for correctness, ");
+	stats[i].valid = eval_mm_valid(trace, i, &ranges);
+	if (stats[i].valid) {
+	    if (verbose > 1)
+		printf("efficiency, ");
+	    stats[i].util = eval_mm_util(trace, i, &ranges);
+	    stats[i].predicted = mm->predictions(&stats[i].right);
+	    speed_params.trace = trace;
+	    speed_params.ranges = ranges;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	}
+	else {
+	    stats[i].util = 0;
+	    stats[i].secs = 0;
+	}
+	free_trace(trace);
+    }
+    clear_ranges(&ranges);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -589,7 +882,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -602,12 +895,31 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's malloc (or memalign or calloc) */
+	    if (trace->ops[i].type == MEMALIGN)
+		p = mm->memalign(trace->ops[i].align, size);
+	    else if (trace->ops[i].type == CALLOC)
+		p = mm->calloc(1, size);
+	    else
+		p = OP_MALLOC(&trace->ops[i], size);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
+	    if (trace->ops[i].type == MEMALIGN &&
+		((uintptr_t)p & (trace->ops[i].align - 1)) != 0) {
+		malloc_error(tracenum, i, "mm_memalign returned a misaligned block.");
+		return 0;
+	    }
+	    if (trace->ops[i].type == CALLOC)
+		for (j = 0; j < size; j++)
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero the block.");
+			return 0;
+		    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
@@ -633,7 +945,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if ((newp = mm->realloc(oldp, size)) == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -671,7 +983,35 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    mm->free(p);
+	    break;
+
+        case FREE_SIZED: /* mm_free_sized */
+	    p = trace->blocks[index];
+	    remove_range(ranges, p);
+	    mm->free_sized(p, trace->block_sizes[index]);
+	    break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+
+	    /* The blocks go straight into the slots of their ids */
+	    if (mm->malloc_batch(size, trace->ops[i].count,
+				(void **)&trace->blocks[index]) != trace->ops[i].count) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (j = index; j < index + trace->ops[i].count; j++) {
+		if (add_range(ranges, trace->blocks[j], size, tracenum, i) == 0)
+		    return 0;
+		memset(trace->blocks[j], j & 0xFF, size);
+		trace->block_sizes[j] = size;
+	    }
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+	    for (j = index; j < index + trace->ops[i].count; j++)
+		remove_range(ranges, trace->blocks[j]);
+	    mm->free_batch((void **)&trace->blocks[index], trace->ops[i].count);
 	    break;
 
 	default:
@@ -689,15 +1029,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   largest size of the heap (plus any regions mapped with mem_map) in
+ *   bytes while running the student's malloc package on the trace. Note
+ *   that mem_sbrk() allows the students to decrement the brk pointer, so
+ *   we use the high water mark rather than the final size. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 {   
-    int i;
+    int i, j;
     int index;
     int size, newsize, oldsize;
     int max_total_size = 0;
@@ -707,17 +1047,25 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
+        case CALLOC: /* mm_calloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (trace->ops[i].type == MEMALIGN)
+		p = mm->memalign(trace->ops[i].align, size);
+	    else if (trace->ops[i].type == CALLOC)
+		p = mm->calloc(1, size);
+	    else
+		p = OP_MALLOC(&trace->ops[i], size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -739,7 +1087,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -760,7 +1108,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -768,13 +1116,42 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    break;
 
+        case FREE_SIZED: /* mm_free_sized */
+	    index = trace->ops[i].index;
+	    size = trace->block_sizes[index];
+	    mm->free_sized(trace->blocks[index], size);
+	    total_size -= size;
+	    break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+
+	    if (mm->malloc_batch(size, trace->ops[i].count,
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		app_error("mm_malloc_batch failed in eval_mm_util");
+	    for (j = index; j < index + trace->ops[i].count; j++)
+		trace->block_sizes[j] = size;
+
+	    total_size += size * trace->ops[i].count;
+	    max_total_size = (total_size > max_total_size) ?
+		total_size : max_total_size;
+	    break;
+
+        case FREE_BATCH: /* mm_free_batch */
+	    index = trace->ops[i].index;
+	    for (j = index; j < index + trace->ops[i].count; j++)
+		total_size -= trace->block_sizes[j];
+	    mm->free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+	    break;
+
 	default:
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -790,7 +1167,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0) 
+    if (mm->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -800,16 +1177,32 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = OP_MALLOC(&trace->ops[i], size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm->memalign(trace->ops[i].align, size)) == NULL)
+		app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm->calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if ((newp = mm->realloc(oldp,newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -817,7 +1210,24 @@ static void eval_mm_speed(void *ptr)
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm->free(block);
+            break;
+
+        case FREE_SIZED: /* mm_free_sized */
+            index = trace->ops[i].index;
+            mm->free_sized(trace->blocks[index], trace->block_sizes[index]);
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            if (mm->malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		app_error("mm_malloc_batch error in eval_mm_speed");
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            mm->free_batch((void **)&trace->blocks[index], trace->ops[i].count);
             break;
 
 	default:
@@ -825,6 +1235,234 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Replays the trace LAT_RUNS times on a fresh heap,
+ *    timing every request on its own, and stores the latency of the
+ *    slowest request of each kind over all runs in worst (in ns, 0 if
+ *    there was none). Unless best is NULL, the latency of the slowest
+ *    request of the run in which it was fastest is stored in best, which
+ *    leaves out most of the interrupts and page faults that a single run
+ *    might be hit by.
+ */
+static void eval_mm_latency(trace_t *trace, double *worst, double *best)
+{
+    int i, run, index, kind;
+    char *p;
+    double ns, slowest[LAT_KINDS];
+    struct timespec start, end;
+
+    for (kind = 0; kind < LAT_KINDS; kind++) {
+	worst[kind] = 0;
+	if (best != NULL)
+	    best[kind] = DBL_MAX;
+    }
+
+    for (run = 0; run < LAT_RUNS; run++) {
+	mem_reset_brk();
+	if (mm->init() < 0) 
+	    app_error("mm_init failed in eval_mm_latency");
+	for (kind = 0; kind < LAT_KINDS; kind++)
+	    slowest[kind] = 0;
+
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    p = NULL;
+	    kind = LAT_MALLOC;
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		p = OP_MALLOC(&trace->ops[i], trace->ops[i].size);
+		break;
+	    case MEMALIGN:
+		p = mm->memalign(trace->ops[i].align, trace->ops[i].size);
+		break;
+	    case CALLOC:
+		p = mm->calloc(1, trace->ops[i].size);
+		break;
+	    case REALLOC:
+		p = mm->realloc(trace->blocks[index], trace->ops[i].size);
+		kind = LAT_REALLOC;
+		break;
+	    case FREE:
+		mm->free(trace->blocks[index]);
+		kind = LAT_FREE;
+		break;
+	    case FREE_SIZED:
+		mm->free_sized(trace->blocks[index], trace->block_sizes[index]);
+		kind = LAT_FREE;
+		break;
+	    case ALLOC_BATCH:
+		if (mm->malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				     (void **)&trace->blocks[index]) != trace->ops[i].count)
+		    app_error("mm_malloc_batch error in eval_mm_latency");
+		break;
+	    case FREE_BATCH:
+		mm->free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+		kind = LAT_FREE;
+		break;
+	    default:
+		app_error("Nonexistent request type in eval_mm_latency");
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+
+	    if (kind != LAT_FREE && trace->ops[i].type != ALLOC_BATCH) {
+		if (p == NULL)
+		    app_error("mm_malloc error in eval_mm_latency");
+		trace->blocks[index] = p;
+	    }
+	    ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	    if (ns > slowest[kind])
+		slowest[kind] = ns;
+	}
+
+	for (kind = 0; kind < LAT_KINDS; kind++) {
+	    if (slowest[kind] > worst[kind])
+		worst[kind] = slowest[kind];
+	    if (best != NULL && slowest[kind] < best[kind])
+		best[kind] = slowest[kind];
+	}
+    }
+}
+
+#if MM_POLICIES
+/*
+ * max_latency - Stores the worst-case latency of each kind of request
+ *     over all valid traces in worst (see eval_mm_latency)
+ */
+static void max_latency(char **tracefiles, int num_tracefiles, 
+			stats_t *stats, double *worst)
+{
+    int i, kind;
+    trace_t *trace;
+    double lat[LAT_KINDS];
+
+    for (kind = 0; kind < LAT_KINDS; kind++)
+	worst[kind] = 0;
+
+    for (i=0; i < num_tracefiles; i++) {
+	if (!stats[i].valid)
+	    continue;
+	trace = read_trace(tracedir, tracefiles[i]);
+	eval_mm_latency(trace, lat, NULL);
+	for (kind = 0; kind < LAT_KINDS; kind++)
+	    if (lat[kind] > worst[kind])
+		worst[kind] = lat[kind];
+	free_trace(trace);
+    }
+}
+#endif
+
+#if MM_THREADS
+/*
+ * replay_trace - The body of each thread started by eval_mm_threads,
+ *    which runs the trace with its own array of block pointers. Returns
+ *    a non-NULL value if the allocator ran out of memory.
+ */
+static void *replay_trace(void *ptr)
+{
+    int i, index;
+    char *p;
+    trace_t *trace = (trace_t *)ptr;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((p = OP_MALLOC(&trace->ops[i], trace->ops[i].size)) == NULL)
+		return trace;
+            trace->blocks[index] = p;
+            break;
+        case MEMALIGN:
+            if ((p = mm->memalign(trace->ops[i].align, trace->ops[i].size)) == NULL)
+		return trace;
+            trace->blocks[index] = p;
+            break;
+        case CALLOC:
+            if ((p = mm->calloc(1, trace->ops[i].size)) == NULL)
+		return trace;
+            trace->blocks[index] = p;
+            break;
+	case REALLOC:
+            if ((p = mm->realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		return trace;
+            trace->blocks[index] = p;
+            break;
+        case FREE:
+            mm->free(trace->blocks[index]);
+            break;
+        case FREE_SIZED:
+            mm->free_sized(trace->blocks[index], trace->block_sizes[index]);
+            break;
+        case ALLOC_BATCH:
+            if (mm->malloc_batch(trace->ops[i].size, trace->ops[i].count,
+				(void **)&trace->blocks[index]) != trace->ops[i].count)
+		return trace;
+            break;
+        case FREE_BATCH:
+            mm->free_batch((void **)&trace->blocks[index], trace->ops[i].count);
+            break;
+	default:
+	    app_error("Nonexistent request type in replay_trace");
+        }
+    }
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replays the trace in nthreads threads at once on a
+ *    fresh heap, and returns the wall clock time that it took (the best
+ *    of a few runs), or a negative value if the heap was too small for
+ *    that many copies of the trace.
+ */
+static double eval_mm_threads(trace_t *trace, int nthreads)
+{
+    int i, run;
+    void *failed;
+    double secs, best = DBL_MAX;
+    struct timeval start, end;
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    trace_t *copies = malloc(nthreads * sizeof(trace_t));
+
+    if (threads == NULL || copies == NULL)
+	unix_error("malloc failed in eval_mm_threads");
+
+    for (i = 0; i < nthreads; i++) {
+	copies[i] = *trace;
+	if ((copies[i].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+	    unix_error("calloc failed in eval_mm_threads");
+    }
+
+    for (run = 0; run < 3; run++) {
+	mem_reset_brk();
+	if (mm->init() < 0) 
+	    app_error("mm_init failed in eval_mm_threads");
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nthreads; i++)
+	    if (pthread_create(&threads[i], NULL, replay_trace, &copies[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_threads");
+	for (i = 0; i < nthreads; i++) {
+	    pthread_join(threads[i], &failed);
+	    if (failed != NULL)
+		best = -1;
+	}
+	gettimeofday(&end, NULL);
+
+	if (best < 0)
+	    break;
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	if (secs < best)
+	    best = secs;
+    }
+
+    for (i = 0; i < nthreads; i++)
+	free(copies[i].blocks);
+    free(copies);
+    free(threads);
+    return best;
+}
+#endif
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -833,7 +1471,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace, int tracenum)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -847,6 +1485,23 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    trace->blocks[trace->ops[i].index] = p;
 	    break;
 
+        case MEMALIGN: /* posix_memalign */
+	    if (posix_memalign((void **)&p, trace->ops[i].align,
+			       trace->ops[i].size) != 0) {
+		malloc_error(tracenum, i, "libc posix_memalign failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[trace->ops[i].index];
@@ -858,9 +1513,24 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    break;
 	    
         case FREE: /* free */
+        case FREE_SIZED:
 	    free(trace->blocks[trace->ops[i].index]);
 	    break;
 
+        case ALLOC_BATCH: /* one malloc per block */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		if ((trace->blocks[trace->ops[i].index + j] =
+		     malloc(trace->ops[i].size)) == NULL) {
+		    malloc_error(tracenum, i, "libc malloc failed");
+		    unix_error("System message");
+		}
+	    break;
+
+        case FREE_BATCH: /* one free per block */
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[trace->ops[i].index + j]);
+	    break;
+
 	default:
 	    app_error("invalid operation type  in eval_libc_valid");
 	}
@@ -876,7 +1546,7 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -891,6 +1561,22 @@ static void eval_libc_speed(void *ptr)
 	    trace->blocks[index] = p;
 	    break;
 
+        case MEMALIGN: /* posix_memalign */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+		unix_error("posix_memalign failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
 	case REALLOC: /* realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
@@ -902,10 +1588,24 @@ static void eval_libc_speed(void *ptr)
 	    break;
 	    
         case FREE: /* free */
+        case FREE_SIZED:
 	    index = trace->ops[i].index;
 	    block = trace->blocks[index];
 	    free(block);
 	    break;
+
+        case ALLOC_BATCH: /* one malloc per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		if ((trace->blocks[index + j] = malloc(trace->ops[i].size)) == NULL)
+		    unix_error("malloc failed in eval_libc_speed");
+	    break;
+
+        case FREE_BATCH: /* one free per block */
+	    index = trace->ops[i].index;
+	    for (j = 0; j < trace->ops[i].count; j++)
+		free(trace->blocks[index + j]);
+	    break;
 	}
     }
 }
@@ -915,6 +1615,25 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * perf_index - Computes the performance index (out of 100) from the
+ *     average space utilization and throughput (in ops per second),
+ *     along with its utilization part p1 and throughput part p2
+ */
+static double perf_index(double avg_util, double avg_throughput,
+			 double *p1, double *p2)
+{
+    *p1 = UTIL_WEIGHT * avg_util;
+    if (avg_throughput > AVG_LIBC_THRUPUT) {
+	*p2 = (double)(1.0 - UTIL_WEIGHT);
+    } 
+    else {
+	*p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
+	    (avg_throughput/AVG_LIBC_THRUPUT);
+    }
+    return (*p1 + *p2)*100.0;
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -1004,14 +1723,18 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValLPS] [-f <file>] [-t <dir>] [-T <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Report the worst-case latency of each kind of request.\n");
+    fprintf(stderr, "\t-P         Compare the placement policies (POLICIES=1 builds).\n");
+    fprintf(stderr, "\t-S         Report how many lifetime predictions were right.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Compare throughput with n threads (THREADS=1 builds).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -18,20 +19,55 @@
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
 static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_dirty_brk;  /* highest brk so far: the heap reads as zeros beyond it */
+#if USE_VMEM
+static char *mem_commit_brk; /* end of the committed pages of the heap */
+#endif
+
+/* regions handed out by mem_map, which live outside of the heap */
+typedef struct map_t {
+    char *start;
+    size_t size;
+    struct map_t *next;
+} map_t;
+
+static map_t *mem_maps;      /* list of mapped regions */
+static size_t mem_mapped;    /* total size of the mapped regions */
+static size_t mem_peak;      /* largest heap size plus mapped size since the last reset */
+
+static void mem_update_peak(void);
+#if USE_VMEM
+static void mem_decommit(char *lo);
+#endif
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+#if USE_VMEM
+    /* reserve the address range of the heap, without committing any of it */
+    mem_start_brk = mmap(NULL, VMEM_RESERVE, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+
+    mem_max_addr = mem_start_brk + VMEM_RESERVE;  /* max legal heap address */
+    mem_commit_brk = mem_start_brk;               /* nothing is committed */
+#else
+    /* allocate the storage we will use to model the available VM (zeroed, like fresh pages) */
+    if ((mem_start_brk = (char *)calloc(1, MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
 
     mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+#endif
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_dirty_brk = mem_start_brk;            /* and all of it reads as zeros */
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +75,239 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#if USE_VMEM
+    munmap(mem_start_brk, VMEM_RESERVE);
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *    and unmap all regions that are still mapped
  */
 void mem_reset_brk()
 {
+    map_t *map;
+
+    while ((map = mem_maps) != NULL) {
+	mem_maps = map->next;
+	munmap(map->start, map->size);
+	free(map);
+    }
+    mem_mapped = 0;
     mem_brk = mem_start_brk;
+    mem_peak = 0;
+#if USE_VMEM
+    mem_decommit(mem_start_brk);
+#endif
 }
 
+#if USE_VMEM
+/*
+ * mem_page_align - rounds the given address up to a page boundary
+ */
+static char *mem_page_align(void *p)
+{
+    return (char *)(((size_t)p + mem_pagesize() - 1) & ~(mem_pagesize() - 1));
+}
+#endif
+
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap by -incr bytes (but never below
+ *    its start), and returns the old brk like sbrk does. With USE_VMEM
+ *    the pages of the heap are committed and decommitted to match.
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr) 
 {
     char *old_brk = mem_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((incr < 0) && (mem_brk + incr < mem_start_brk)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Cannot shrink below the start of the heap...\n");
+	return (void *)-1;
+    }
+    if ((mem_brk + incr) > mem_max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
+#if USE_VMEM
+    if (mem_brk + incr > mem_commit_brk) {
+	char *commit_brk = mem_page_align(mem_brk + incr);
+
+	if (mprotect(mem_commit_brk, commit_brk - mem_commit_brk,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	    return (void *)-1;
+	}
+	mem_commit_brk = commit_brk;
+    }
+    else if (incr < 0)
+	mem_decommit(mem_page_align(mem_brk + incr));
+#endif
     mem_brk += incr;
+    if (mem_brk > mem_dirty_brk)
+	mem_dirty_brk = mem_brk;
+    mem_update_peak();
     return (void *)old_brk;
 }
 
+#if USE_VMEM
+/*
+ * mem_decommit - gives the committed pages from lo (which must be page
+ *    aligned) up to the end of the committed heap back to the system,
+ *    while keeping their address range reserved
+ */
+static void mem_decommit(char *lo)
+{
+    if (lo >= mem_commit_brk)
+	return;
+    madvise(lo, mem_commit_brk - lo, MADV_DONTNEED);
+    mprotect(lo, mem_commit_brk - lo, PROT_NONE);
+    mem_commit_brk = lo;
+    if (lo < mem_dirty_brk)
+	mem_dirty_brk = lo;  /* the pages come back as zeros when committed again */
+}
+#endif
+
+/*
+ * mem_zero_lo - returns the address from which the memory beyond the
+ *    brk is known to read as zeros (as it has never been part of the
+ *    heap since it was last committed), so that the next mem_sbrk
+ *    hands it out zeroed from there on
+ */
+void *mem_zero_lo()
+{
+    return (void *)(mem_brk > mem_dirty_brk ? mem_brk : mem_dirty_brk);
+}
+
+/*
+ * mem_purge - tells the system that the contents of the whole pages
+ *    between lo and lo + size are no longer needed, so that it can take
+ *    them back (they stay part of the heap, and read as zeros afterwards).
+ *    Without USE_VMEM this does nothing.
+ */
+void mem_purge(void *lo, size_t size)
+{
+#if USE_VMEM
+    char *start = mem_page_align(lo);
+    char *end = (char *)(((size_t)lo + size) & ~(mem_pagesize() - 1));
+
+    if (start < end)
+	madvise(start, end - start, MADV_DONTNEED);
+#else
+    (void)lo;
+    (void)size;
+#endif
+}
+
+/*
+ * mem_map - maps a region of size bytes outside of the heap (a model
+ *    of an anonymous mmap), and returns its start address, or (void *)-1
+ *    if that failed
+ */
+void *mem_map(size_t size)
+{
+    map_t *map;
+    char *start = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (start == MAP_FAILED || (map = malloc(sizeof(map_t))) == NULL) {
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	if (start != MAP_FAILED)
+	    munmap(start, size);
+	return (void *)-1;
+    }
+    map->start = start;
+    map->size = size;
+    map->next = mem_maps;
+    mem_maps = map;
+    mem_mapped += size;
+    mem_update_peak();
+    return (void *)start;
+}
+
+/*
+ * mem_find_map - returns the link that points to the region that starts
+ *    at the given address (or NULL if there is no such region)
+ */
+static map_t **mem_find_map(void *start)
+{
+    map_t **link;
+
+    for (link = &mem_maps; *link != NULL; link = &(*link)->next)
+	if ((*link)->start == (char *)start)
+	    return link;
+    return NULL;
+}
+
+/*
+ * mem_unmap - unmaps the region of size bytes at start, which must have
+ *    been mapped by mem_map (or mem_remap)
+ */
+void mem_unmap(void *start, size_t size)
+{
+    map_t **link = mem_find_map(start);
+    map_t *map;
+
+    assert(link != NULL && (*link)->size == size);
+    map = *link;
+    *link = map->next;
+    munmap(map->start, map->size);
+    mem_mapped -= map->size;
+    free(map);
+}
+
+/*
+ * mem_remap - resizes the region at start from old_size to new_size bytes
+ *    (a model of mremap, which may move the region), and returns its new
+ *    start address, or (void *)-1 if that failed
+ */
+void *mem_remap(void *start, size_t old_size, size_t new_size)
+{
+    map_t **link = mem_find_map(start);
+    char *new_start;
+
+    assert(link != NULL && (*link)->size == old_size);
+    new_start = mremap(start, old_size, new_size, MREMAP_MAYMOVE);
+    if (new_start == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mem_remap failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    (*link)->start = new_start;
+    (*link)->size = new_size;
+    mem_mapped += new_size - old_size;
+    mem_update_peak();
+    return (void *)new_start;
+}
+
+/*
+ * mem_is_mapped - returns whether the bytes lo through hi all lie in a
+ *    single mapped region
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    map_t *map;
+
+    for (map = mem_maps; map != NULL; map = map->next)
+	if ((char *)lo >= map->start && (char *)hi < map->start + map->size)
+	    return 1;
+    return 0;
+}
+
+/*
+ * mem_update_peak - remembers the current heap and mapped size if it is
+ *    the largest so far
+ */
+static void mem_update_peak(void)
+{
+    if (mem_heapsize() + mem_mapped > mem_peak)
+	mem_peak = mem_heapsize() + mem_mapped;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -92,6 +332,23 @@ size_t mem_heapsize()
     return (size_t)(mem_brk - mem_start_brk);
 }
 
+/*
+ * mem_mapsize() - returns the total size of the mapped regions in bytes
+ */
+size_t mem_mapsize() 
+{
+    return mem_mapped;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest size in bytes of the heap
+ *    and the mapped regions together since the heap was last reset
+ */
+size_t mem_peak_heapsize() 
+{
+    return mem_peak;
+}
+
 /*
  * mem_pagesize() - returns the page size of the system
  */
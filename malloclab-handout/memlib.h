@@ -1,11 +1,20 @@
 #include <unistd.h>
+#include <stdint.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
+void *mem_map(size_t size);
+void mem_unmap(void *start, size_t size);
+void *mem_remap(void *start, size_t old_size, size_t new_size);
+int mem_is_mapped(void *lo, void *hi);
+void mem_purge(void *lo, size_t size);
+void *mem_zero_lo(void);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_mapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
 
@@ -35,11 +35,15 @@ team_t team = {
     ""
 };
 
-/* single word (4) or double word (8) alignment */
+/* double word (8) alignment, or 16 bytes on 64-bit systems */
+#if __SIZEOF_POINTER__ == 8
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8
+#endif
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -75,6 +79,13 @@ void mm_free(void *ptr)
 {
 }
 
+/*
+ * mm_free_sized - Freeing a block does nothing, whatever its size.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+}
+
 /*
  * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
  */
@@ -95,16 +106,84 @@ void *mm_realloc(void *ptr, size_t size)
     return newptr;
 }
 
+/*
+ * mm_memalign - Allocate a block whose payload is aligned to align bytes
+ *     (a power of two), by padding a larger block. The size is stored
+ *     right in front of the aligned payload, as for any other block.
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    char *p;
 
+    if (align < ALIGNMENT)
+	align = ALIGNMENT;
+    if ((p = mm_malloc(size + align)) == NULL)
+	return NULL;
+    p = (char *)(((size_t)p + align - 1) & ~(align - 1));
+    *(size_t *)(p - SIZE_T_SIZE) = size;
+    return p;
+}
 
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    void *p;
 
+    if (size != 0 && nmemb > (size_t)-1 / size)
+	return NULL;
+    if ((p = mm_malloc(nmemb * size)) != NULL)
+	memset(p, 0, nmemb * size);
+    return p;
+}
 
+/*
+ * mm_malloc_batch - Allocate n blocks of the given size, one at a time
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t i;
 
+    for (i = 0; i < n; i++)
+	if ((out[i] = mm_malloc(size)) == NULL)
+	    break;
+    return i;
+}
 
+/*
+ * mm_free_batch - Free n blocks, one at a time
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    size_t i;
 
+    for (i = 0; i < n; i++)
+	mm_free(ptrs[i]);
+}
 
+/*
+ * mm_trim - The heap never shrinks, so there is nothing to trim.
+ */
+int mm_trim(size_t pad)
+{
+    return 0;
+}
 
+/*
+ * mm_predictions - Nothing is predicted, so no prediction was right.
+ */
+unsigned int mm_predictions(unsigned int *right)
+{
+    *right = 0;
+    return 0;
+}
 
-
-
-
+/*
+ * mm_ops - The interface of this package (it has no placement policy).
+ */
+const mm_ops_t mm_ops = {
+    "naive", mm_init, mm_malloc, mm_free, mm_free_sized, mm_calloc,
+    mm_realloc, mm_memalign, mm_malloc_batch, mm_free_batch, mm_trim,
+    mm_predictions
+};
@@ -4,30 +4,231 @@
  * Size stored in header = entire length of block (incl. header and footer)
  * block basepointer = points to start of data (not start of header)
  * size of header/footer = one word (4 bytes)
+ * only free blocks have a footer, allocated blocks use the space for payload
  */
 
 /**
- * We have implemented a dynamic memory allocator using an implicit free list and
- * the first_fit algorithm and 8 byte alignment.
+ * We have implemented a dynamic memory allocator using segregated explicit free
+ * lists and the first_fit algorithm and 8 byte alignment (16 bytes on 64-bit
+ * systems, where every block size is then a multiple of 16).
  * 
  * Block structure:
- *  Header (4 bytes) (length + allocated bit)
+ *  Header (4 bytes) (length + prev allocated bit + allocated bit)
  *  Payload
  *  (optional) padding
+ *
+ * Free block structure:
+ *  Header (4 bytes) (length + prev allocated bit + allocated bit)
+ *  Predecessor in free list (4 bytes, offset from the start of the heap)
+ *  Successor in free list (4 bytes, offset from the start of the heap)
+ *  (optional) unused space
  *  Footer (4 bytes) (length + allocated bit)
- * 
- * When blocks should be placed (alloc) then the first available spot in the heap
- * is chosen.
+ *
+ * Since every header keeps track of whether the previous block is allocated, we
+ * only need to read the footer of the previous block when it is free, and thus
+ * allocated blocks do not need a footer. This means the overhead of an allocated
+ * block is only 4 bytes.
+ *
+ * The links are stored as offsets rather than pointers so that they always fit
+ * in a single word, which keeps the minimum block size at 16 bytes (also on
+ * 64-bit systems). An offset of 0 is used as NULL (the first word of the heap
+ * is padding and never a block). Sizes that do not fit in a 4-byte tag are
+ * always given a mapping of their own, which records its length in a size_t.
+ *
+ * Free blocks are kept in one of NUM_BINS free lists (bins) depending on their
+ * size. Small sizes have a bin each (16, 24, ..., 128 bytes), while larger sizes
+ * share a bin per power of two ((128, 256], (256, 512], ...). A bitmap keeps track
+ * of which bins are non-empty.
+ *
+ * Free blocks are inserted at the front of their bin (LIFO), and when blocks
+ * should be placed (alloc) then the first block in the bin of the requested size
+ * that is large enough is chosen. If that bin has no fit, then the bitmap is used
+ * to jump straight to the first non-empty larger bin, whose first block is
+ * guaranteed to fit. This is the default FIT_POLICY (first fit), which can be
+ * swapped at compile time for next fit (every shared bin has a roving pointer
+ * that the next search starts at), best fit (the smallest block in the bin) or
+ * good fit (the smallest of the first FIT_CANDIDATES blocks that fit). Building
+ * with -DMM_PREFIX renames everything that mm.c exports, so that the driver can
+ * link a build of every policy and compare them (through their mm_ops tables).
+ *
+ * The TLSF policy (two-level segregated fit) bounds the time of every search
+ * instead. Its bins split every power of two (the first level) into
+ * TLSF_SL_COUNT equal ranges (the second level), with a bitmap per level. A
+ * request is rounded up to the next range, so that the head of any non-empty
+ * bin from there on fits, and that bin is found with one count-trailing-zeros
+ * on each level. Free blocks are never kept in the tree then, and the fast
+ * bins are off by default (merging them takes time in proportion to their
+ * contents), so that malloc and free take O(1) time when the heap does not
+ * have to grow. Blocks keep the same boundary tags, and are coalesced the same
+ * way.
+ *
+ * Free blocks of TREE_THRESHOLD bytes or more are not kept in a bin, but in a
+ * treap (a binary search tree that is kept balanced by giving every node a
+ * pseudo-random priority and keeping the nodes with the highest priorities at
+ * the top). The tree is ordered by size (and address for blocks of equal size)
+ * and the nodes are stored inside the free blocks themselves:
+ *
+ * Large free block structure:
+ *  Header (4 bytes) (length + prev allocated bit + allocated bit)
+ *  Left child (4 bytes, offset from the start of the heap)
+ *  Right child (4 bytes, offset from the start of the heap)
+ *  Parent (4 bytes, offset from the start of the heap)
+ *  (optional) unused space
+ *  Footer (4 bytes) (length + allocated bit)
+ *
+ * The priority of a node is a hash of its offset, so it does not have to be
+ * stored. This allows us to find the smallest free block that fits a large
+ * request (best fit) in O(log n) time.
+ *
+ * The free block right before the epilogue (the top block) is kept out of the
+ * bins and the tree. It is only carved from when no other free block fits, so
+ * the holes in the heap are filled before the top is split (the remainder of a
+ * split simply becomes the new top block), which keeps the top in one piece for
+ * trim_heap to give back and for the heap to grow into.
+ *
+ * Blocks that are grown by mm_realloc are remembered in a small table of
+ * reservations (RESERVE_SLOTS entries), and have the reserved bit set in their
+ * header. Each time such a block has to grow again, it gets some extra slack
+ * that scales with the number of times it has grown (capped at RESERVE_MAX), so
+ * that a buffer that is grown repeatedly only has to be copied rarely. The table
+ * knows how much of each block is actually in use, so the slack can always be
+ * given back: it is split off when the heap would otherwise have to be extended,
+ * when the reservation is evicted from the table, or when the block is shrunk.
+ *
+ * Requests of SLAB_MAX bytes or less are not given a block of their own, but a
+ * slot in a slab. A slab is an allocated block of SLAB_SIZE bytes whose payload
+ * starts at a page boundary, and it holds slots of a single size class:
+ *
+ * Slab structure:
+ *  Header (4 bytes) (length + prev allocated bit + allocated bit)
+ *  Next/previous slab of the same class with free slots (4 bytes each, offsets)
+ *  Slot size and number of free slots (2 bytes each)
+ *  Bitmap of free slots
+ *  Slots (without any header or footer)
+ *
+ * The slots are allocated by finding the first set bit in the bitmap (with a
+ * count-trailing-zeros instruction), and freed by setting the bit again. A page
+ * map with a bit per page of the heap tells whether a pointer lies in a slab,
+ * in which case the slab is found by rounding the pointer down to its page.
+ * A size only gets its first slab once SLAB_START requests of it in a row were
+ * given an ordinary block without any of those being freed, so a program that
+ * keeps just a few small blocks around never pays for a mostly empty page.
+ *
+ * All of the free structures above (bins, tree, reservations and slab lists)
+ * belong to an arena. When compiled with MM_THREADS there are NUM_ARENAS arenas,
+ * each with its own lock, and threads are assigned to them round-robin (a thread
+ * that finds its arena locked moves on to the next one). Each arena grows in
+ * segments, and a map with the owner of every ARENA_CHUNK of the heap lets
+ * mm_free give a block back to the arena it came from. Segments are fenced by
+ * their own prologue and epilogue, so blocks are never coalesced across arenas
+ * (the prologue of a segment that starts inside a chunk of another arena is
+ * stretched to the next chunk boundary):
+ *
+ * Segment structure:
+ *  Alignment padding (4 bytes)
+ *  Prologue header and footer (4 bytes each)
+ *  Blocks
+ *  Epilogue header (4 bytes)
+ *
+ * When an arena owns the top of the heap, it extends its last segment instead
+ * (which is always the case without MM_THREADS, so there is a single segment).
+ * A free block at the top only has to be topped up by the shortfall, and
+ * otherwise the heap grows by at least a chunk that doubles while the heap
+ * keeps growing (and falls back to a page once free blocks are reused
+ * instead). Likewise, only that arena can shrink the heap: when a free leaves
+ * a free block of at least TRIM_THRESHOLD bytes before the epilogue,
+ * everything but TRIM_PAD bytes of it is given back with a negative mem_sbrk
+ * (and mm_trim does the same on request). A block of at least PURGE_THRESHOLD bytes that is
+ * freed elsewhere keeps its place in the heap, but the whole pages inside it
+ * are given back with mem_purge (which only has an effect with the virtual
+ * memory backend of memlib). That happens once: the smaller blocks that are
+ * carved out of the free block later are not purged again when they are freed.
+ *
+ * The footer of a free block that has not been used since it came from
+ * mem_sbrk (which knows how far the memory beyond the brk reads as zeros) has
+ * the fresh bit set. Splitting such a block keeps the bit on the remainder,
+ * while merging it with anything but fresh memory clears it, so mm_calloc only
+ * has to clear the links and footer of a block that it carves out of one.
+ *
+ * Freed blocks of up to FASTBIN_MAX bytes are not coalesced right away, but
+ * pushed onto a fast bin: a LIFO list per block size (linked through the first
+ * word of the payload), whose blocks stay allocated as far as their neighbours
+ * are concerned. A request of exactly that size pops the last one again, so a
+ * block that is freed and allocated over and over never touches the bins. The
+ * fast bins are consolidated (sorted by address, merged and coalesced like the
+ * remote free stacks) when they hold more than FASTBIN_LIMIT bytes, when a
+ * request finds no fit before the heap would be extended, and by mm_trim.
+ *
+ * mm_malloc_batch carves a whole batch of blocks out of one free block, and
+ * mm_free_batch sorts the blocks it is given by address, so that runs of
+ * neighbours are merged and coalesced once (like the remote free stacks).
+ *
+ * mm_memalign (and mm_aligned_alloc and mm_posix_memalign) take a free block
+ * that is large enough to hold the request at any offset, and split off the
+ * gap in front of the aligned payload as a free block of its own, so that
+ * aligned blocks waste no more than ordinary ones.
+ *
+ * Requests of at least MMAP_THRESHOLD bytes bypass the arenas, and get an
+ * anonymous mapping of their own (through mem_map), so that large buffers never
+ * fragment the heap. Such a block is tagged with a header of size 0, and the
+ * (wide) length of its mapping is stored right before that:
+ *
+ * Mapped block structure:
+ *  Length of the mapping (size_t)
+ *  Padding
+ *  Header (4 bytes) with size 0 and the allocated bit
+ *  Payload (at MMAP_OFFSET bytes from the start of the mapping)
+ *
+ * mm_free unmaps such a block, and mm_realloc resizes its mapping (with
+ * mem_remap, which moves pages rather than copying bytes). Heap blocks that
+ * realloc has to move anyway are moved to a mapping once they are large enough.
+ *
+ * On top of the arenas, every thread has a cache (tcache) of small blocks and
+ * slots that it has freed, with a LIFO list per multiple of DSIZE. Cached blocks
+ * stay allocated as far as the arenas are concerned, so mm_malloc and mm_free
+ * can pop and push them without taking any lock. An empty list is refilled
+ * with TCACHE_BATCH blocks from the arena of the thread, and a full list gives
+ * TCACHE_BATCH blocks back to their arenas (all under a single lock per arena).
+ * mm_free_sized uses the size that the caller passes to pick the list, so a
+ * small block is freed without touching its header (and slots, which have no
+ * header at all, are only looked at once a list is flushed; building with a
+ * SLAB_MAX of TCACHE_MAX puts every block that can be cached in a slab).
+ *
+ * Built with LIFETIME_SITES, mm_malloc predicts how long a block will live from
+ * its call site (the return address of mm_malloc). Every thread samples some of
+ * its blocks, and counts per site how many of them were freed within a short
+ * while. Blocks of a site whose blocks mostly die young are cut from the top
+ * block, so that they coalesce back into it once they are freed, and leave no
+ * holes between the long-lived blocks, which fill the free lists first.
+ * mm_predictions tells how many of the predictions were right (mdriver -S
+ * prints it for every trace, and the trace sites-bal.rep allocates from
+ * several call sites).
+ *
+ * A thread never locks another arena to free a block. Instead it pushes the
+ * block onto the remote free stack of the arena (a lock-free list with a
+ * compare-and-swap on its head), and the next malloc in the arena takes the
+ * whole stack at once. The batch is sorted by address, so that blocks that
+ * are next to each other are merged before they are coalesced (once per run).
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include "mm.h"
 #include "memlib.h"
 
+/** Build the thread-safe allocator (with multiple arenas) by compiling with -DMM_THREADS=1 */
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+
+#if MM_THREADS
+#include <pthread.h>
+#endif
+
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
  * provide your team information in the following struct.
@@ -48,307 +249,3590 @@ team_t team = {
 #define DSIZE 8
 #define CHUNKSIZE mem_pagesize()
 
+/* double word (8) alignment, or 16 bytes on 64-bit systems (the alignment of max_align_t) */
+#if __SIZEOF_POINTER__ == 8
+#define ALIGNMENT 16
+#else
+#define ALIGNMENT DSIZE
+#endif
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~(size_t)(ALIGNMENT - 1))
+
+/** The largest block size that fits in a 4-byte tag, larger requests always get a mapping (with a wide length) */
+#define TAG_SIZE_MAX 0xFFFFFFF0u
+#define IS_HUGE(size) ((size) > TAG_SIZE_MAX - ALIGNMENT)
+
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/**
+ * The policy for picking a block from a shared bin: the first one that fits, the
+ * first one that fits after where the previous search of the bin ended, the
+ * smallest one that fits, or the smallest of the first FIT_CANDIDATES that fit.
+ * TLSF replaces the bins with two-level ones, whose heads always fit.
+ */
+#define FIRST_FIT 0
+#define NEXT_FIT 1
+#define BEST_FIT 2
+#define GOOD_FIT 3
+#define TLSF_FIT 4
+#ifndef FIT_POLICY
+#define FIT_POLICY FIRST_FIT
+#endif
+#ifndef FIT_CANDIDATES
+#define FIT_CANDIDATES 4
+#endif
+
+/** TLSF splits every power of two into 2^TLSF_SL_BITS bins (sizes below TLSF_SMALL get a bin per multiple of DSIZE) */
+#ifndef TLSF_SL_BITS
+#define TLSF_SL_BITS 4
+#endif
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_SHIFT (TLSF_SL_BITS + 3) // 2^3 is DSIZE
+#define TLSF_SMALL (1u << TLSF_FL_SHIFT)
+#define TLSF_FL_COUNT (32 - TLSF_FL_SHIFT + 1)
+
+/** The number of segregated free lists, the bitmap of non-empty bins has a bit per bin (per first level for TLSF) */
+#if FIT_POLICY == TLSF_FIT
+#define NUM_BINS (TLSF_FL_COUNT * TLSF_SL_COUNT)
+#else
+#define NUM_BINS 32
+#endif
+
+/** Blocks up to this size have a bin of their own (one per multiple of DSIZE) */
+#define SMALL_BIN_MAX 128
+#define SMALL_BINS (SMALL_BIN_MAX / DSIZE - 1)
+
+/** Free blocks of at least this size are kept in the size-ordered tree instead of a bin (never with TLSF) */
+#ifndef TREE_THRESHOLD
+#define TREE_THRESHOLD 1024
+#endif
+#if TREE_THRESHOLD < 5 * WSIZE
+#error "TREE_THRESHOLD must leave room for a header, three links and a footer (5 words)"
+#endif
+#define IN_TREE(size) (FIT_POLICY != TLSF_FIT && (size) >= TREE_THRESHOLD)
+
+#if FIT_POLICY == FIRST_FIT
+#define FIT_POLICY_NAME "first-fit"
+#elif FIT_POLICY == NEXT_FIT
+#define FIT_POLICY_NAME "next-fit"
+#elif FIT_POLICY == BEST_FIT
+#define FIT_POLICY_NAME "best-fit"
+#elif FIT_POLICY == GOOD_FIT
+#define FIT_POLICY_NAME "good-fit"
+#elif FIT_POLICY == TLSF_FIT
+#define FIT_POLICY_NAME "tlsf"
+#else
+#error "FIT_POLICY must be FIRST_FIT, NEXT_FIT, BEST_FIT, GOOD_FIT or TLSF_FIT"
+#endif
+
+/** The number of blocks grown by realloc that we keep track of (and reserve slack for) */
+#define RESERVE_SLOTS 8
+
+/** Requests of up to SLAB_MAX bytes are served from slabs of SLAB_SIZE bytes (0 disables slabs) */
+#ifndef SLAB_MAX
+#define SLAB_MAX 64
+#endif
+#define SLAB_SIZE 4096
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT)
+
+/** A class only gets its first slab after SLAB_START of its requests in a row got an ordinary block (and none of those blocks was freed) */
+#ifndef SLAB_START
+#define SLAB_START 32
+#endif
+
+/** The size of the bitmap of a slab (enough for slabs of the smallest class) */
+#define SLAB_MAP_WORDS 16
+
+/** The size of the slab header (the slots start right after it) */
+#define SLAB_HDR_SIZE 80
+
+/** Slabs can only be placed in the first SLAB_HEAP_MAX bytes of the heap (as that is what the page map covers) */
+#define SLAB_HEAP_MAX (64 * 1024 * 1024)
+#define SLAB_PAGE_WORDS (SLAB_HEAP_MAX / SLAB_SIZE / 32)
+
+/** Computes the index of the page that the given address lies in (relative to the heap) */
+#define PAGE_INDEX(p) ((size_t)(p) / SLAB_SIZE - (size_t)heap_base / SLAB_SIZE)
+
+/** Finds the slab that a slot lies in */
+#define SLAB_OF(p) ((slab_t *)((size_t)(p) & ~(size_t)(SLAB_SIZE - 1)))
+
+/** The number of arenas, and the unit (and alignment) that they grab memory from the heap in */
+#if MM_THREADS
+#ifndef NUM_ARENAS
+#define NUM_ARENAS 8
+#endif
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_MAP_SIZE 16384
+#else
+#define NUM_ARENAS 1
+#endif
+
+/** Locks an arena, the heap (mem_sbrk) and updates the page map (without MM_THREADS this is a no-op) */
+#if MM_THREADS
+#define LOCK(a) pthread_mutex_lock(&(a)->lock)
+#define UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+#define LOCK_SBRK() pthread_mutex_lock(&sbrk_lock)
+#define UNLOCK_SBRK() pthread_mutex_unlock(&sbrk_lock)
+#define MAP_GET(word) __atomic_load_n(&(word), __ATOMIC_RELAXED)
+#define MAP_SET(word, bits) __atomic_fetch_or(&(word), (bits), __ATOMIC_RELAXED)
+#define MAP_CLEAR(word, bits) __atomic_fetch_and(&(word), ~(bits), __ATOMIC_RELAXED)
+#else
+#define LOCK(a)
+#define UNLOCK(a)
+#define LOCK_SBRK()
+#define UNLOCK_SBRK()
+#define MAP_GET(word) (word)
+#define MAP_SET(word, bits) ((word) |= (bits))
+#define MAP_CLEAR(word, bits) ((word) &= ~(bits))
+#endif
+
+/** The heap grows by at least a chunk, which doubles while the heap keeps growing (up to GROW_MAX bytes, or 1/GROW_RATIO of the heap) */
+#ifndef GROW_MAX
+#define GROW_MAX (64 * 1024)
+#endif
+#ifndef GROW_RATIO
+#define GROW_RATIO 16
+#endif
+
+/** The top of the heap is given back once it is a free block of TRIM_THRESHOLD bytes, keeping TRIM_PAD bytes (0 disables trimming) */
+#ifndef TRIM_THRESHOLD
+#define TRIM_THRESHOLD (128 * 1024)
+#endif
+#ifndef TRIM_PAD
+#define TRIM_PAD (32 * 1024)
+#endif
+
+/** The pages inside freed blocks of at least PURGE_THRESHOLD bytes are given back with mem_purge (0 disables this) */
+#ifndef PURGE_THRESHOLD
+#define PURGE_THRESHOLD (64 * 1024)
+#endif
+
+/** Requests of at least MMAP_THRESHOLD bytes get a mapping of their own (0 disables this) */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD (128 * 1024)
+#endif
+
+/** The offset of the payload of a mapped block from the start of its mapping */
+#define MMAP_OFFSET (2 * DSIZE)
+
+/** Requests of up to TCACHE_MAX bytes are cached per thread, with at most TCACHE_COUNT blocks per size (0 disables the cache) */
+#ifndef TCACHE_MAX
+#define TCACHE_MAX 256
+#endif
+#ifndef TCACHE_COUNT
+#define TCACHE_COUNT 16
+#endif
+#define TCACHE_CLASSES (TCACHE_MAX / DSIZE)
+
+/** The number of blocks that are moved between a tcache and the arenas at a time */
+#ifndef TCACHE_BATCH
+#define TCACHE_BATCH (TCACHE_COUNT / 2)
+#endif
+
+/** mm_malloc_batch carves at most BATCH_MAX bytes worth of blocks out of a single free block */
+#ifndef BATCH_MAX
+#define BATCH_MAX (64 * 1024)
+#endif
+
+/** Freed blocks of up to FASTBIN_MAX bytes are kept in fast bins without being coalesced, until they hold more than FASTBIN_LIMIT bytes (0 disables them) */
+#ifndef FASTBIN_MAX
+#if FIT_POLICY == TLSF_FIT
+#define FASTBIN_MAX 0
+#else
+#define FASTBIN_MAX 512
+#endif
+#endif
+#ifndef FASTBIN_LIMIT
+#define FASTBIN_LIMIT (64 * 1024)
+#endif
+#define FASTBIN_CLASSES (FASTBIN_MAX / ALIGNMENT)
+
+/** Lifetimes are predicted from a table of LIFETIME_SITES call sites per thread, by sampling one in LIFETIME_RATE of its blocks (0 disables the predictions) */
+#ifndef LIFETIME_SITES
+#define LIFETIME_SITES 0
+#endif
+#ifndef LIFETIME_RATE
+#define LIFETIME_RATE 4
+#endif
+
+/** A thread tracks up to LIFETIME_SAMPLES blocks at a time, and a block is short-lived if it is freed within LIFETIME_SHORT allocations of the thread */
+#ifndef LIFETIME_SAMPLES
+#define LIFETIME_SAMPLES 256
+#endif
+#ifndef LIFETIME_SHORT
+#define LIFETIME_SHORT 256
+#endif
+
+/** The lifetime that is predicted for the blocks of a call site */
+#define PREDICT_NONE 0
+#define PREDICT_SHORT 1
+#define PREDICT_LONG 2
+
+/** The link of a block in a tcache list, fast bin or remote free stack (stored at the start of its payload) */
+#define NEXT_LINK(p) (*(void **)(p))
+
+/** Variables that every thread has its own copy of (there is only one thread without MM_THREADS) */
+#if MM_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+/** The maximum amount of slack reserved for a single block */
+#ifndef RESERVE_MAX
+#define RESERVE_MAX (16 * 1024)
+#endif
 
 #define PACK(size, alloc) ((size) | (alloc))
 
 #define GET(p) (*(unsigned int *)(p))
 #define PUT(p, val) (*(unsigned int *)(p) = (val))
 
+/** Bit in a header telling whether the previous block is allocated */
+#define PREV_ALLOC 0x2
+
+/** Bit in the header of an allocated block telling whether it has a reservation */
+#define RESERVED 0x4
+
+/** Bit in the footer of a free block telling whether its payload reads as zeros (apart from its links and footer) */
+#define FRESH 0x2
+
 #define GET_SIZE(p) (GET(p) & ~0x7)
 #define IS_ALLOC(p) (GET(p) & 0x1)
+#define IS_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define IS_RESERVED(p) (GET(p) & RESERVED)
+
+/** Reads and sets the fresh bit of a free block */
+#define IS_FRESH(bp) (GET(FTRP(bp)) & FRESH)
+#define SET_FRESH(bp) PUT(FTRP(bp), GET(FTRP(bp)) | FRESH)
+
+/** Updates the prev allocated bit in the header of the given block */
+#define SET_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) | PREV_ALLOC)
+#define CLEAR_PREV_ALLOC(bp) PUT(HDRP(bp), GET(HDRP(bp)) & ~PREV_ALLOC)
 
 /* HDRP computes the address of the given pointers block header */
 #define HDRP(bp) ((char *)(bp)-WSIZE)
 
-/** Computes the address to the footer of a block */
+/** Computes the address to the footer of a block (only free blocks have one) */
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
+/** Computes the next/previous block, PREV_BLKP is only valid if the previous block is free */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp)-WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp)-GET_SIZE(((char *)(bp)-DSIZE)))
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT DISZE
+/** Mapped blocks are tagged with a size of 0 (which no heap block has), and know the length of their mapping */
+#define IS_MMAPPED(bp) (GET_SIZE(HDRP(bp)) == 0)
+#define MAP_LENGTH(bp) (*(size_t *)((char *)(bp)-MMAP_OFFSET))
 
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+/** Converts between block pointers and the offsets stored in the free list links */
+#define TO_OFFSET(bp) ((bp) ? (unsigned int)((char *)(bp)-heap_base) : 0)
+#define FROM_OFFSET(off) ((off) ? (void *)(heap_base + (off)) : NULL)
+
+/** Computes the address of the predecessor/successor links of a free block */
+#define PRED_LINK(bp) ((char *)(bp))
+#define SUCC_LINK(bp) ((char *)(bp) + WSIZE)
+
+/** Reads the predecessor/successor of a free block in the free list */
+#define PRED_FREE(bp) FROM_OFFSET(GET(PRED_LINK(bp)))
+#define SUCC_FREE(bp) FROM_OFFSET(GET(SUCC_LINK(bp)))
+
+/** Computes the address of the child/parent links of a free block in the tree */
+#define LEFT_LINK(bp) ((char *)(bp))
+#define RIGHT_LINK(bp) ((char *)(bp) + WSIZE)
+#define PARENT_LINK(bp) ((char *)(bp) + 2 * WSIZE)
+
+/** Reads the children/parent of a free block in the tree */
+#define LEFT(bp) FROM_OFFSET(GET(LEFT_LINK(bp)))
+#define RIGHT(bp) FROM_OFFSET(GET(RIGHT_LINK(bp)))
+#define PARENT(bp) FROM_OFFSET(GET(PARENT_LINK(bp)))
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
 // Will point to the start of the usable heap
-void *heap_listp;
+static void *heap_listp;
+
+// Points to the first byte of the heap, which free list offsets are relative to
+static char *heap_base;
 
 /**
- * Attempts to coalese the given block (pointer) with the previous and next block,
- * in order to keep free blocks as long as possible.
+ * A block that has been grown by realloc. The block may be larger than the
+ * amount of bytes in use, in which case the rest is reserved slack.
  */
-static void *coalesce(void *bp)
+typedef struct
 {
-    //char *next_hdr = HDRP(NEXT_BLKP(bp));
-    size_t prev_alloc = IS_ALLOC(FTRP(PREV_BLKP(bp)));
-    size_t next_alloc = IS_ALLOC(HDRP(NEXT_BLKP(bp)));
-    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int offset; // Offset of the block (0 if the slot is unused)
+    unsigned int used;   // The adjusted size that is actually in use
+    unsigned int grows;  // The number of times the block has been grown
+} reservation_t;
 
-    /** If prev and next is both allocated then we cannot do anything. */
-    if (prev_alloc && next_alloc)
-    {
-        return bp;
-    }
+/**
+ * The header of a slab, which is stored at the start of its (page aligned) payload
+ */
+typedef struct
+{
+    unsigned int next;                    // Offset of the next slab of this class with free slots
+    unsigned int prev;                    // Offset of the previous slab of this class with free slots
+    unsigned short slotSize;              // The size of each slot
+    unsigned short freeSlots;             // The number of free slots
+    unsigned int freeMap[SLAB_MAP_WORDS]; // Bit i is set if slot i is free
+} slab_t;
 
-    /** If prev is allocated and next is free, merge with next block */
-    else if (prev_alloc && !next_alloc)
-    {
-        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size, 0));
-    }
+// Bit i is set if page i of the heap is (the payload of) a slab
+static unsigned int slab_pages[SLAB_PAGE_WORDS];
 
-    /** Same as above, however with the prev block free and the next block allocated */
-    else if (!prev_alloc && next_alloc)
-    {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
-    }
+/**
+ * An independent heap with its own free structures (and lock). Without
+ * MM_THREADS there is only a single arena.
+ */
+typedef struct
+{
+    // Points to the first block in each of the segregated free lists (or NULL if empty)
+    void *seg_lists[NUM_BINS];
 
-    /** If both prev and next are free blocks, then merge all together to on big block */
-    else
-    {
-        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-        bp = PREV_BLKP(bp);
-    }
+    // Bit i is set when seg_lists[i] is non-empty (for TLSF, when a bin of first
+    // level i is non-empty, and bit j of sl_maps[i] when its bin j is)
+    unsigned int bin_map;
 
-    return bp;
-}
+#if FIT_POLICY == TLSF_FIT
+    unsigned int sl_maps[TLSF_FL_COUNT];
+#endif
+
+#if FIT_POLICY == NEXT_FIT
+    // The block in each bin that the next search of the bin starts at (or NULL to
+    // start at the head)
+    void *rovers[NUM_BINS];
+#endif
+
+    // Points to the root of the tree of large free blocks (or NULL if it is empty)
+    void *tree_root;
+
+    // The blocks grown by realloc, and the slot that will be evicted next if it is full
+    reservation_t reservations[RESERVE_SLOTS];
+    int next_reservation;
+
+    // Points to the first slab with free slots of each class (or NULL if there is none)
+    slab_t *slab_lists[SLAB_CLASSES + 1];
+
+    // The number of small requests in a row that got an ordinary block, per size
+    // of that block (in multiples of ALIGNMENT), which a free of such a block resets
+    unsigned int slab_streaks[SLAB_CLASSES + 2];
+
+    // Points to the last freed block of each size that has not been coalesced yet
+    // (or NULL if there is none), and the number of bytes in all of them
+    void *fastbins[FASTBIN_CLASSES + 1];
+    size_t fastbin_bytes;
+
+    // Points just past the epilogue of the last segment of the arena
+    char *heap_end;
+
+    // Points to the free block right before that epilogue (or NULL if the last
+    // block is allocated), which is kept out of the bins and the tree
+    void *top;
+
+    // The least amount of bytes that the heap grows by next, and the bytes of the
+    // blocks that have been looked for since it last grew
+    size_t grow_chunk;
+    size_t grow_found;
+
+#if MM_THREADS
+    pthread_mutex_t lock;
+
+    // Blocks freed by threads of other arenas, which are waiting to be freed here
+    void *remote_frees;
+#endif
+} arena_t;
+
+static arena_t arenas[NUM_ARENAS];
+
+#if MM_THREADS
+// Protects memlib (mem_sbrk and the mappings) and the arena map
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The arena that owns each ARENA_CHUNK of the heap
+static unsigned char arena_map[ARENA_MAP_SIZE];
+
+// The arena that the calling thread allocates from (assigned on its first malloc)
+static __thread arena_t *thread_arena;
+
+// The arena that the next new thread is assigned to
+static unsigned int next_arena;
+
+// Used to flush the tcache of a thread when it exits
+static pthread_key_t tcache_key;
+#endif
 
 /**
- * Internal helper that extends the heap by the amount of words specified
+ * The cache of a thread, with a list (linked through the first word of the
+ * payloads) and the number of blocks in it for every multiple of DSIZE
  */
-static void *extend_heap(size_t words)
+typedef struct
 {
-    /** Allocate even number of words to maintain alignment */
-    size_t size = ((words % 2) ? (words + 1) : words) * WSIZE;
-    char *bp = mem_sbrk(size);
+    void *lists[TCACHE_CLASSES + 1];
+    unsigned short counts[TCACHE_CLASSES + 1];
+    unsigned int generation; // The value of heap_generation that the cache belongs to
+} tcache_t;
 
-    if (bp == (char *)-1)
-    {
-        return NULL;
-    }
+static THREAD_LOCAL tcache_t tcache;
 
-    PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
-    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+// Incremented by mm_init, so that caches of threads from before a reset are discarded
+static unsigned int heap_generation;
 
-    return (void *)coalesce(bp);
-}
+#if LIFETIME_SITES > 0
+/**
+ * The lifetimes of the sampled blocks of a call site of mm_malloc
+ */
+typedef struct
+{
+    void *site;                // The return address of the call (NULL if the slot is unused)
+    unsigned short shortLived; // The number of sampled blocks that were short-lived
+    unsigned short longLived;  // The number of sampled blocks that were not
+} site_t;
 
 /**
- * Helper that traverses the implicit freelist and returns the first block that
- * is free and is larger than or equal to the size requested
+ * A sampled block that has not been freed yet
  */
-static void *find_fit(size_t size)
+typedef struct
 {
-    void *bp;
+    void *ptr;               // The block (NULL if the slot is unused)
+    void *site;              // The call site that allocated it
+    unsigned int birth;      // The allocation clock of the thread when it was allocated
+    unsigned int prediction; // The lifetime that was predicted for it
+} sample_t;
+
+/**
+ * The lifetime predictor of a thread, which counts how many of its predictions
+ * turned out to be right (once the sampled blocks are freed)
+ */
+typedef struct
+{
+    site_t sites[LIFETIME_SITES];
+    sample_t samples[LIFETIME_SAMPLES];
+    unsigned int clock;      // The number of blocks that the thread has allocated from the arenas
+    unsigned int predicted;  // The number of freed samples that had a prediction
+    unsigned int correct;    // The number of those predictions that were right
+    unsigned int generation; // The value of heap_generation that the predictor belongs to
+} lifetime_t;
+
+static THREAD_LOCAL lifetime_t lifetime;
+#endif
+
+/**
+ * Computes the bin that a free block of the given (aligned) size belongs in
+ */
+static int bin_index(size_t size)
+{
+    int bin;
 
-    // As long as there is a next block, continue! (which will conitnue until
-    // we reach the prologue block with a size of 0)
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+#if FIT_POLICY == TLSF_FIT
+    int fl;
+
+    // Small blocks have an exact bin on the first level (one per multiple of DSIZE)
+    if (size < TLSF_SMALL)
     {
-        // In case we find a block that isn't allocated and is large enough to
-        // contain our block, then return it!
-        if (!IS_ALLOC(HDRP(bp)) && (size <= GET_SIZE(HDRP(bp))))
-        {
-            return bp;
-        }
+        return size / DSIZE;
     }
 
-    return NULL;
+    // Larger blocks are in first level fl (for sizes in [2^fl, 2^(fl + 1)), with
+    // the sizes below TLSF_SMALL in level 0), and in the second level bin given by
+    // the TLSF_SL_BITS bits below the highest set bit
+    fl = 31 - __builtin_clz((unsigned int)size);
+    bin = (size >> (fl - TLSF_SL_BITS)) ^ TLSF_SL_COUNT;
+
+    return (fl - TLSF_FL_SHIFT + 1) * TLSF_SL_COUNT + bin;
+#else
+    // Small blocks have an exact bin (16 bytes goes in bin 0, 24 in bin 1, etc.)
+    if (size <= SMALL_BIN_MAX)
+    {
+        return size / DSIZE - 2;
+    }
+
+    // Larger blocks share a bin per power of two, i.e. (128, 256] goes in the
+    // first bin after the small bins, (256, 512] in the next one and so on.
+    // (31 - clz computes the index of the highest set bit)
+    bin = SMALL_BINS + (31 - __builtin_clz((unsigned int)(size - 1))) - 7;
+
+    return bin < NUM_BINS ? bin : NUM_BINS - 1;
+#endif
 }
 
+#if FIT_POLICY == TLSF_FIT
+/** Whether the bitmaps have the bit of the given bin set */
+#define BIN_MAPPED(a, bin) (((a)->sl_maps[(bin) / TLSF_SL_COUNT] >> ((bin) % TLSF_SL_COUNT)) & 1)
+#else
+#define BIN_MAPPED(a, bin) (((a)->bin_map >> (bin)) & 1)
+#endif
+
 /**
- * Places a block at the given pointer with a given size
+ * Inserts the given free block at the front of the bin matching its size
  */
-void place(void *ptr, size_t asize)
+static void insert_bin(arena_t *a, void *bp)
 {
-    size_t oldSize = GET_SIZE(HDRP(ptr));
+    int bin = bin_index(GET_SIZE(HDRP(bp)));
+    void *head = a->seg_lists[bin];
 
-    if (oldSize - asize >= (2 * DSIZE))
-    {
-        // In case we need to split the free block, then do so now
-        // by first placing our new block (by placing a header and footer with
-        // the desired size)
-        // (by placing the header first, then we ensure the footer is positioned correctly)
-        PUT(HDRP(ptr), PACK(asize, 1));
-        PUT(FTRP(ptr), PACK(asize, 1));
-        ptr = NEXT_BLKP(ptr);
-        // and then updating the remainder of the free block with a new header and
-        // updated footer refleting the new size and that it is free
-        PUT(HDRP(ptr), PACK(oldSize - asize, 0));
-        PUT(FTRP(ptr), PACK(oldSize - asize, 0));
-    }
-    else
+    PUT(PRED_LINK(bp), 0);
+    PUT(SUCC_LINK(bp), TO_OFFSET(head));
+
+    if (head != NULL)
     {
-        // If the allocated size fits the free block perfectly (i.e. less than 16 bytes free), then just
-        // update the current free block to be allocated (the rest of the bytes wouldn't be usable either way)
-        PUT(HDRP(ptr), PACK(oldSize, 1));
-        PUT(FTRP(ptr), PACK(oldSize, 1));
+        PUT(PRED_LINK(head), TO_OFFSET(bp));
     }
+
+    a->seg_lists[bin] = bp;
+#if FIT_POLICY == TLSF_FIT
+    a->sl_maps[bin / TLSF_SL_COUNT] |= 1u << (bin % TLSF_SL_COUNT);
+    a->bin_map |= 1u << (bin / TLSF_SL_COUNT);
+#else
+    a->bin_map |= 1u << bin;
+#endif
 }
 
 /**
- * Diagnostics function that checks all blocks in the heap, including the prologue-
- * block, but stops at the epilogue block
+ * Unlinks the given free block from its bin by connecting its predecessor and
+ * successor to each other
  */
-int mm_check(void)
+static void remove_bin(arena_t *a, void *bp)
 {
-    int blocks = 0;
-    int blocksSize = 0;
-    int free = 0;
-    int freeSize = 0;
-    int notCoalesced = 0;
+    void *pred = PRED_FREE(bp);
+    void *succ = SUCC_FREE(bp);
 
-    char *ptr = heap_listp;
+#if FIT_POLICY == NEXT_FIT
+    // A search that would have started at this block starts at its successor
+    if (a->rovers[bin_index(GET_SIZE(HDRP(bp)))] == bp)
+    {
+        a->rovers[bin_index(GET_SIZE(HDRP(bp)))] = succ;
+    }
+#endif
 
-    while (GET_SIZE(HDRP(ptr)))
+    if (pred != NULL)
     {
-        // Gather diagnostics regarding the current block
-        char *hp = HDRP(ptr);
-        int size = GET_SIZE(hp);
-        blocks++;
-        blocksSize += size;
+        PUT(SUCC_LINK(pred), TO_OFFSET(succ));
+    }
+    else
+    {
+        // The block was the head of its bin, so the bin now starts at the successor
+        int bin = bin_index(GET_SIZE(HDRP(bp)));
+        a->seg_lists[bin] = succ;
 
-        if (!IS_ALLOC(hp))
+        if (succ == NULL)
         {
-            free++;
-            freeSize += size;
-            size_t prev_alloc = IS_ALLOC(FTRP(PREV_BLKP(ptr)));
-            size_t next_alloc = IS_ALLOC(HDRP(NEXT_BLKP(ptr)));
-
-            if (!prev_alloc || !next_alloc)
+#if FIT_POLICY == TLSF_FIT
+            // The first level bit goes once its last non-empty bin does
+            if ((a->sl_maps[bin / TLSF_SL_COUNT] &= ~(1u << (bin % TLSF_SL_COUNT))) == 0)
             {
-                notCoalesced++;
+                a->bin_map &= ~(1u << (bin / TLSF_SL_COUNT));
             }
+#else
+            a->bin_map &= ~(1u << bin);
+#endif
         }
-
-        // Move to next block!
-        ptr += size;
     }
 
-    printf("Heapsize: %i bytes. Not using %i bytes\n%i blocks (size = %i), including proglogue in the heap\n%i blocks are free (size = %i)\n%i blocks were not coalesced.\n\n", mem_heapsize(), (mem_heapsize() - blocksSize), blocks, blocksSize, free, freeSize, notCoalesced);
+    if (succ != NULL)
+    {
+        PUT(PRED_LINK(succ), TO_OFFSET(pred));
+    }
+}
 
-    return 0;
+/**
+ * Computes the priority of a node in the tree, which is a hash of its offset
+ * (Knuth's multiplicative hash) so that it does not have to be stored
+ */
+static unsigned int tree_priority(void *bp)
+{
+    unsigned int x = TO_OFFSET(bp) * 2654435761u;
+    return x ^ (x >> 16);
 }
 
-/*
- * mm_init - initialize the malloc package.
+/**
+ * Compares two blocks by size, and by address if they have the same size.
+ * Returns a negative number if a goes before b, and a positive number otherwise.
  */
-int mm_init(void)
+static int tree_compare(void *a, void *b)
 {
-    /* Create initial empty heap */
-    heap_listp = mem_sbrk(4 * WSIZE);
+    size_t aSize = GET_SIZE(HDRP(a));
+    size_t bSize = GET_SIZE(HDRP(b));
 
-    if (heap_listp == (void *)-1)
+    if (aSize != bSize)
     {
-        return -1;
+        return aSize < bSize ? -1 : 1;
     }
 
-    PUT(heap_listp, 0);                            /** Allignment padding */
-    PUT(heap_listp + (WSIZE), PACK(DSIZE, 1));     /** Prologue header*/
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /** Prologue footer*/
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));     /** Epilogue header */
-    heap_listp += (WSIZE * 2);
+    return (char *)a < (char *)b ? -1 : ((char *)a > (char *)b);
+}
+
+/**
+ * Makes the given node take the place of old in the tree (in the eyes of the
+ * parent of old)
+ */
+static void tree_replace(arena_t *a, void *old, void *node)
+{
+    void *parent = PARENT(old);
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE / WSIZE) == (void *)-1)
+    if (parent == NULL)
     {
-        return -1;
+        a->tree_root = node;
+    }
+    else if (LEFT(parent) == old)
+    {
+        PUT(LEFT_LINK(parent), TO_OFFSET(node));
+    }
+    else
+    {
+        PUT(RIGHT_LINK(parent), TO_OFFSET(node));
     }
 
-    return 0;
+    if (node != NULL)
+    {
+        PUT(PARENT_LINK(node), TO_OFFSET(parent));
+    }
 }
 
-/*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
- *     Always allocate a block whose size is a multiple of the alignment.
+/**
+ * Rotates the given node up above its parent, while keeping the order of the tree
  */
-void *mm_malloc(size_t size)
+static void tree_rotate_up(arena_t *a, void *node)
 {
-    // Ignore irrelevant requests
-    if (size == 0)
-    {
-        return NULL;
-    }
+    void *parent = PARENT(node);
+    void *child;
 
-    size_t asize;      // Adjusted block size (i.e. aligned)
-    size_t extendsize; // Size we need to extend to make room for the requested size
-    char *ptr;
+    tree_replace(a, parent, node);
 
-    // Adjust block size to include overhead (header and footer) and alignment
-    if (size <= DSIZE)
+    if (LEFT(parent) == node)
     {
-        // the smallest we can assign is 16 bytes (8 for header and footer and 8 for content + padding)
-        asize = 2 * DSIZE;
+        // The right subtree of the node is moved to the left of the old parent
+        child = RIGHT(node);
+        PUT(LEFT_LINK(parent), TO_OFFSET(child));
+        PUT(RIGHT_LINK(node), TO_OFFSET(parent));
     }
     else
     {
-        // Round down to the lowest amount of bytes we need while maintaining alignment + overhead
-        asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+        // The left subtree of the node is moved to the right of the old parent
+        child = LEFT(node);
+        PUT(RIGHT_LINK(parent), TO_OFFSET(child));
+        PUT(LEFT_LINK(node), TO_OFFSET(parent));
     }
 
-    // Search the free list for a fit
-    ptr = find_fit(asize);
-    if (ptr == NULL)
+    if (child != NULL)
     {
-        // If none, extend the heap to a fitting size
-        extendsize = MAX(asize, CHUNKSIZE);
-
-        if ((ptr = extend_heap(extendsize / WSIZE)) == NULL)
-        {
-            return NULL;
-        }
+        PUT(PARENT_LINK(child), TO_OFFSET(parent));
     }
 
-    place(ptr, asize);
-    return ptr;
+    PUT(PARENT_LINK(parent), TO_OFFSET(node));
 }
 
-/*
- * Frees the block at the given pointer, by flipping the allocated fields to 0
- * and afterwards attempts to coalesce the prev and next block.
+/**
+ * Inserts the given free block in the tree as a leaf, and then rotates it up
+ * until its parent has a higher priority than itself
  */
-void mm_free(void *ptr)
+static void insert_tree(arena_t *a, void *bp)
 {
-    size_t size = GET_SIZE(HDRP(ptr));
+    void *parent = NULL;
+    void *node = a->tree_root;
+    unsigned int priority = tree_priority(bp);
 
-    PUT(HDRP(ptr), PACK(size, 0));
-    PUT(FTRP(ptr), PACK(size, 0));
-    coalesce(ptr);
-}
+    PUT(LEFT_LINK(bp), 0);
+    PUT(RIGHT_LINK(bp), 0);
 
-/*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
- */
+    // Find the leaf position of the block
+    while (node != NULL)
+    {
+        parent = node;
+        node = tree_compare(bp, node) < 0 ? LEFT(node) : RIGHT(node);
+    }
+
+    PUT(PARENT_LINK(bp), TO_OFFSET(parent));
+
+    if (parent == NULL)
+    {
+        a->tree_root = bp;
+        return;
+    }
+    else if (tree_compare(bp, parent) < 0)
+    {
+        PUT(LEFT_LINK(parent), TO_OFFSET(bp));
+    }
+    else
+    {
+        PUT(RIGHT_LINK(parent), TO_OFFSET(bp));
+    }
+
+    while (PARENT(bp) != NULL && tree_priority(PARENT(bp)) < priority)
+    {
+        tree_rotate_up(a, bp);
+    }
+}
+
+/**
+ * Removes the given free block from the tree, by rotating it down until it has
+ * at most one child, and then letting that child take its place
+ */
+static void remove_tree(arena_t *a, void *bp)
+{
+    void *left = LEFT(bp);
+    void *right = RIGHT(bp);
+
+    while (left != NULL && right != NULL)
+    {
+        // Rotate the child with the highest priority up, to keep the heap order
+        tree_rotate_up(a, tree_priority(left) > tree_priority(right) ? left : right);
+        left = LEFT(bp);
+        right = RIGHT(bp);
+    }
+
+    tree_replace(a, bp, left != NULL ? left : right);
+}
+
+#if FIT_POLICY != TLSF_FIT
+/**
+ * Finds the smallest block in the tree that is larger than or equal to the
+ * requested size (best fit)
+ */
+static void *find_tree(arena_t *a, size_t size)
+{
+    void *best = NULL;
+    void *node = a->tree_root;
+
+    while (node != NULL)
+    {
+        if (GET_SIZE(HDRP(node)) >= size)
+        {
+            // The node fits, but there might be a smaller one to the left
+            best = node;
+            node = LEFT(node);
+        }
+        else
+        {
+            node = RIGHT(node);
+        }
+    }
+
+    return best;
+}
+#endif
+
+/**
+ * Inserts the given free block in the bin or tree matching its size, unless it
+ * is the last block of the arena, which becomes its top block instead
+ */
+static void insert_free(arena_t *a, void *bp)
+{
+    if (NEXT_BLKP(bp) == a->heap_end)
+    {
+        // A top block is only left behind when the arena starts a new segment,
+        // after which it is an ordinary free block
+        if (a->top != NULL)
+        {
+            void *old = a->top;
+
+            a->top = NULL;
+            insert_free(a, old);
+        }
+
+        a->top = bp;
+    }
+    else if (IN_TREE(GET_SIZE(HDRP(bp))))
+    {
+        insert_tree(a, bp);
+    }
+    else
+    {
+        insert_bin(a, bp);
+    }
+}
+
+/**
+ * Removes the given free block from the bin or tree it is kept in (or takes
+ * the top block)
+ */
+static void remove_free(arena_t *a, void *bp)
+{
+    if (bp == a->top)
+    {
+        a->top = NULL;
+    }
+    else if (IN_TREE(GET_SIZE(HDRP(bp))))
+    {
+        remove_tree(a, bp);
+    }
+    else
+    {
+        remove_bin(a, bp);
+    }
+}
+
+/**
+ * Attempts to coalese the given block (pointer) with the previous and next block,
+ * in order to keep free blocks as long as possible.
+ *
+ * The given block must not be in the free list yet. Neighbours that are merged
+ * are removed from the free list, and the resulting block is inserted into it.
+ * Since the result is free, the prev allocated bit of the next block is cleared.
+ */
+static void *coalesce(arena_t *a, void *bp)
+{
+    size_t prev_alloc = IS_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = IS_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    /** If prev and next is both allocated then we cannot do anything. */
+    if (prev_alloc && next_alloc)
+    {
+        CLEAR_PREV_ALLOC(NEXT_BLKP(bp));
+        insert_free(a, bp);
+        return bp;
+    }
+
+    /** If prev is allocated and next is free, merge with next block */
+    else if (prev_alloc && !next_alloc)
+    {
+        remove_free(a, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    /** Same as above, however with the prev block free and the next block allocated */
+    else if (!prev_alloc && next_alloc)
+    {
+        remove_free(a, PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        PUT(FTRP(bp), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        bp = PREV_BLKP(bp);
+    }
+
+    /** If both prev and next are free blocks, then merge all together to on big block */
+    else
+    {
+        remove_free(a, PREV_BLKP(bp));
+        remove_free(a, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) + GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        bp = PREV_BLKP(bp);
+    }
+
+    // (a free block is never followed by another free block, so the next block
+    // of the result must be allocated)
+    CLEAR_PREV_ALLOC(NEXT_BLKP(bp));
+    insert_free(a, bp);
+    return bp;
+}
+
+/**
+ * Internal helper that extends the heap of the given arena by the amount of words
+ * specified. If the arena doesn't own the top of the heap, then the new memory
+ * becomes a new segment (with its own prologue and epilogue).
+ */
+static void *extend_heap(arena_t *a, size_t words)
+{
+    /** Allocate a multiple of the alignment (the prologue makes sure that payloads are aligned) */
+    size_t size = ALIGN(words * WSIZE);
+    size_t prologue = DSIZE;
+    char *brk;
+    char *bp;
+    char *merged;
+    char *zero;
+    int fresh;
+
+    LOCK_SBRK();
+    brk = (char *)mem_heap_hi() + 1;
+    zero = mem_zero_lo();
+
+    if (brk != a->heap_end)
+    {
+#if MM_THREADS
+        // The first block of a segment must start in a chunk that no other arena
+        // owns, so the prologue is stretched to the next chunk (if brk is inside
+        // one). The segment itself only takes what was asked for, and grows like
+        // any top of the heap for as long as no other arena extends the heap.
+        if ((brk - heap_base) % ARENA_CHUNK != 0)
+        {
+            prologue = ARENA_CHUNK - (brk - heap_base) % ARENA_CHUNK + DSIZE;
+        }
+#endif
+        size += prologue + 2 * WSIZE;
+    }
+
+#if MM_THREADS
+    if ((brk - heap_base + size) / ARENA_CHUNK >= ARENA_MAP_SIZE)
+    {
+        UNLOCK_SBRK();
+        return NULL;
+    }
+#endif
+
+    if ((bp = mem_sbrk(size)) == (char *)-1)
+    {
+        UNLOCK_SBRK();
+        return NULL;
+    }
+
+    if (brk == a->heap_end)
+    {
+        /* The new block starts at the old epilogue, which knows whether the last block is allocated */
+        PUT(HDRP(bp), PACK(size, IS_PREV_ALLOC(HDRP(bp)))); /* Free block header */
+    }
+    else
+    {
+        PUT(bp, 0);                                      /** Allignment padding */
+        PUT(bp + (WSIZE), PACK(prologue, 1));            /** Prologue header*/
+        PUT(bp + prologue, PACK(prologue, 1));           /** Prologue footer*/
+        bp += prologue + 2 * WSIZE;
+        size -= prologue + 2 * WSIZE;
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));           /* Free block header */
+    }
+
+    PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    a->heap_end = (char *)mem_heap_hi() + 1;
+
+#if MM_THREADS
+    // Every chunk that the new block reaches into belongs to this arena
+    memset(arena_map + (bp - heap_base) / ARENA_CHUNK, a - arenas,
+           (a->heap_end - 1 - heap_base) / ARENA_CHUNK - (bp - heap_base) / ARENA_CHUNK + 1);
+#endif
+    UNLOCK_SBRK();
+
+    // Memory that was part of the heap before is only worth clearing if it is
+    // no more than the end of a page (e.g. after the heap shrunk), otherwise the
+    // new block simply isn't fresh
+    if (zero > bp && zero - bp <= CHUNKSIZE)
+    {
+        memset(bp, 0, MIN(zero, FTRP(bp)) - bp);
+        zero = bp;
+    }
+
+    // The block stays fresh when merged with a fresh free block before it (the
+    // old footer and epilogue end up in the payload, so they are cleared, unless
+    // the links of the merged block are kept there)
+    fresh = bp >= zero && (IS_PREV_ALLOC(HDRP(bp)) || IS_FRESH(PREV_BLKP(bp)));
+    merged = coalesce(a, bp);
+
+    if (fresh)
+    {
+        zero = MAX(bp - DSIZE, merged + 3 * WSIZE);
+        if (zero < bp)
+        {
+            memset(zero, 0, bp - zero);
+        }
+
+        SET_FRESH(merged);
+    }
+
+    return merged;
+}
+
+/**
+ * Extends the heap of the given arena to make room for a free block of at least
+ * asize bytes. If the last block of the arena is free, the heap only grows by
+ * the shortfall beyond it. Otherwise it grows by at least the chunk of the
+ * arena, which doubles every time, so that a program that keeps growing its
+ * heap needs fewer and fewer calls to mem_sbrk. The chunk falls back to
+ * CHUNKSIZE once the blocks that were looked for since the heap last grew add
+ * up to more than twice the chunk (most of them must have come from free
+ * blocks, so growth has stopped). A chunk is never more than a small part of
+ * the heap, which bounds how far the heap overshoots its peak.
+ */
+static void *grow_heap(arena_t *a, size_t asize)
+{
+    size_t top = 0;
+    size_t size;
+    char *bp;
+
+    if (a->grow_found > 2 * a->grow_chunk)
+    {
+        a->grow_chunk = CHUNKSIZE;
+    }
+
+    if (a->heap_end != NULL && !IS_PREV_ALLOC(HDRP(a->heap_end)))
+    {
+        top = GET_SIZE(a->heap_end - DSIZE);
+    }
+
+    // A free top block is only topped up, so the heap does not overshoot the peak
+    if (top > 0 && top < asize)
+    {
+        size = asize - top;
+    }
+    else
+    {
+        size = MAX(asize, MIN(a->grow_chunk, MAX(mem_heapsize() / GROW_RATIO, CHUNKSIZE)));
+        a->grow_chunk = MIN(2 * a->grow_chunk, MAX(GROW_MAX, CHUNKSIZE));
+    }
+
+    // Another arena may take the top of the heap in the meantime, in which case the
+    // new memory becomes a segment of its own, without the free block before it
+    while ((bp = extend_heap(a, size / WSIZE)) != NULL && GET_SIZE(HDRP(bp)) < asize)
+    {
+        size = asize;
+    }
+
+    a->grow_found = 0;
+    return bp;
+}
+
+/**
+ * Internal helper that gives the free block at the top of the heap back (with a
+ * negative mem_sbrk), except for the given amount of bytes. Only the arena that
+ * owns the top of the heap can shrink it. Returns whether the heap shrunk.
+ */
+static int trim_heap(arena_t *a, size_t pad)
+{
+    size_t size;
+    size_t release;
+    unsigned int fresh;
+    char *bp;
+
+    LOCK_SBRK();
+
+    if ((char *)mem_heap_hi() + 1 != a->heap_end || IS_PREV_ALLOC(HDRP(a->heap_end)))
+    {
+        UNLOCK_SBRK();
+        return 0;
+    }
+
+    // The last block is free, so its footer is right before the epilogue
+    size = GET_SIZE(a->heap_end - DSIZE);
+    bp = a->heap_end - size;
+    release = size > pad ? (size - pad) & ~(size_t)(ALIGNMENT - 1) : 0;
+
+    // Whatever is left of the block must still fit a free block
+    if (release < size && size - release < 2 * DSIZE)
+    {
+        release -= ALIGNMENT;
+    }
+
+    if (release == 0)
+    {
+        UNLOCK_SBRK();
+        return 0;
+    }
+
+    remove_free(a, bp);
+
+    if (release < size)
+    {
+        fresh = IS_FRESH(bp);
+        size -= release;
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));     /* Free block header */
+        PUT(FTRP(bp), PACK(size, fresh));          /* Free block footer */
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));      /* New epilogue header */
+    }
+    else
+    {
+        PUT(HDRP(bp), PACK(0, 1 | PREV_ALLOC));    /* New epilogue header */
+    }
+
+    mem_sbrk(-(intptr_t)release);
+    a->heap_end = (char *)mem_heap_hi() + 1;
+    UNLOCK_SBRK();
+
+    // What is left of the block is the top block again
+    if (!IS_PREV_ALLOC(HDRP(a->heap_end)))
+    {
+        insert_free(a, bp);
+    }
+
+    // The heap shrinks, so it has stopped growing
+    a->grow_chunk = CHUNKSIZE;
+    return 1;
+}
+
+#if FIT_POLICY == TLSF_FIT
+/**
+ * Finds a free block that is larger than or equal to the size requested in
+ * constant time. The size is rounded up to the next bin, so that the head of
+ * that bin or any non-empty bin after it fits: the bitmap of its first level
+ * is searched for such a bin first, and otherwise the bitmap of the first
+ * levels for the next non-empty one (whose lowest non-empty bin is taken). A
+ * block in the bin of the size itself that would have fit is passed over (the
+ * price of a bounded search). The top block is only carved from when nothing
+ * else fits.
+ */
+static void *find_fit(arena_t *a, size_t size)
+{
+    int bin = bin_index(size);
+    int fl;
+    unsigned int map;
+
+    if (size >= TLSF_SMALL && (size & ((1u << (31 - __builtin_clz((unsigned int)size) - TLSF_SL_BITS)) - 1)) != 0)
+    {
+        bin++;
+    }
+
+    if (bin < NUM_BINS)
+    {
+        fl = bin / TLSF_SL_COUNT;
+        map = a->sl_maps[fl] & (~0u << (bin % TLSF_SL_COUNT));
+
+        if (map == 0 && (map = a->bin_map & (~0u << (fl + 1))) != 0)
+        {
+            fl = __builtin_ctz(map);
+            map = a->sl_maps[fl];
+        }
+
+        if (map != 0)
+        {
+            return a->seg_lists[fl * TLSF_SL_COUNT + __builtin_ctz(map)];
+        }
+    }
+
+    if (a->top != NULL && GET_SIZE(HDRP(a->top)) >= size)
+    {
+        return a->top;
+    }
+
+    return NULL;
+}
+#else
+/**
+ * Searches the given bin for a free block of at least size bytes according to
+ * FIT_POLICY (which is fixed at compile time, so each policy gets a loop of its
+ * own), and returns NULL if there is none
+ */
+static void *search_bin(arena_t *a, int bin, size_t size)
+{
+#if FIT_POLICY == NEXT_FIT
+    // Start where the previous search ended, and wrap around to the head
+    void *start = a->rovers[bin] != NULL ? a->rovers[bin] : a->seg_lists[bin];
+
+    for (void *bp = start; bp != NULL;)
+    {
+        if (size <= GET_SIZE(HDRP(bp)))
+        {
+            a->rovers[bin] = SUCC_FREE(bp);
+            return bp;
+        }
+
+        bp = SUCC_FREE(bp) != NULL ? SUCC_FREE(bp) : a->seg_lists[bin];
+
+        if (bp == start)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+#elif FIT_POLICY == BEST_FIT || FIT_POLICY == GOOD_FIT
+    // Keep the smallest block that fits, until one fits exactly (or enough
+    // blocks that fit have been seen)
+    void *best = NULL;
+    int candidates = 0;
+
+    for (void *bp = a->seg_lists[bin]; bp != NULL; bp = SUCC_FREE(bp))
+    {
+        size_t bsize = GET_SIZE(HDRP(bp));
+
+        if (size > bsize)
+        {
+            continue;
+        }
+
+        if (best == NULL || bsize < GET_SIZE(HDRP(best)))
+        {
+            best = bp;
+        }
+
+        if (bsize == size || (FIT_POLICY == GOOD_FIT && ++candidates >= FIT_CANDIDATES))
+        {
+            break;
+        }
+    }
+
+    return best;
+#else
+    for (void *bp = a->seg_lists[bin]; bp != NULL; bp = SUCC_FREE(bp))
+    {
+        if (size <= GET_SIZE(HDRP(bp)))
+        {
+            return bp;
+        }
+    }
+
+    return NULL;
+#endif
+}
+
+/**
+ * Helper that finds a free block that is larger than or equal to the size
+ * requested, by first looking through the bin of the requested size and then
+ * jumping to the first non-empty larger bin. Large requests (and small requests
+ * that no bin can satisfy) are served by a best fit lookup in the tree. The top
+ * block is only carved from when nothing else fits, so that it stays in one
+ * piece for as long as possible (and can be given back by trim_heap).
+ */
+static void *find_fit(arena_t *a, size_t size)
+{
+    void *bp;
+    int bin;
+    unsigned int larger;
+
+    if (!IN_TREE(size))
+    {
+        bin = bin_index(size);
+
+        // Blocks in a small bin all have exactly the requested size, while blocks in
+        // a shared bin might be too small, so in that case we look for one that is
+        // large enough (every block in the list is free, so we only have to check
+        // the size)
+        if ((bp = search_bin(a, bin, size)) != NULL)
+        {
+            return bp;
+        }
+
+        // Every block in a larger bin is large enough, so search the first non-empty
+        // one (found with a single count-trailing-zeros on the bitmap), which takes
+        // its head unless the policy looks for a smaller block
+        larger = bin + 1 < NUM_BINS ? a->bin_map & (~0u << (bin + 1)) : 0;
+
+        if (larger != 0)
+        {
+            return search_bin(a, __builtin_ctz(larger), size);
+        }
+    }
+
+    if ((bp = find_tree(a, size)) == NULL && a->top != NULL && GET_SIZE(HDRP(a->top)) >= size)
+    {
+        bp = a->top;
+    }
+
+    return bp;
+}
+#endif
+
+/**
+ * Places a block at the given pointer with a given size, and returns whether
+ * the free block was fresh (the remainder of a fresh block is fresh as well)
+ */
+static int place(arena_t *a, void *ptr, size_t asize)
+{
+    size_t oldSize = GET_SIZE(HDRP(ptr));
+    unsigned int fresh = IS_FRESH(ptr);
+
+    // The block is no longer free, so it must leave the free list
+    remove_free(a, ptr);
+
+    if (oldSize - asize >= (2 * DSIZE))
+    {
+        // In case we need to split the free block, then do so now
+        // by first placing our new block (by placing a header with the desired
+        // size, the previous block of a free block is always allocated)
+        PUT(HDRP(ptr), PACK(asize, 1 | PREV_ALLOC));
+        ptr = NEXT_BLKP(ptr);
+        // and then updating the remainder of the free block with a new header and
+        // updated footer refleting the new size and that it is free
+        PUT(HDRP(ptr), PACK(oldSize - asize, PREV_ALLOC));
+        PUT(FTRP(ptr), PACK(oldSize - asize, fresh));
+        insert_free(a, ptr);
+    }
+    else
+    {
+        // If the allocated size fits the free block perfectly (i.e. less than 16 bytes free), then just
+        // update the current free block to be allocated (the rest of the bytes wouldn't be usable either way)
+        PUT(HDRP(ptr), PACK(oldSize, 1 | PREV_ALLOC));
+        SET_PREV_ALLOC(NEXT_BLKP(ptr));
+    }
+
+    return fresh != 0;
+}
+
+/**
+ * Computes the size of the block needed to hold the given amount of payload,
+ * including overhead (header) and alignment
+ */
+static size_t adjust_size(size_t size)
+{
+    if (size <= 3 * WSIZE)
+    {
+        // the smallest we can assign is 16 bytes (as the block must be able to hold
+        // a header, the free list links and a footer when it is freed)
+        return 2 * DSIZE;
+    }
+
+    // Round down to the lowest amount of bytes we need while maintaining alignment + overhead
+    return ALIGN(size + WSIZE);
+}
+
+/**
+ * Turns the given allocated block into a block of size bytes, of which only
+ * asize bytes are needed. If the rest is large enough to be a block of its own,
+ * then it is split off and freed (which coalesces it with a free next block).
+ * The prev allocated and reserved bits of the block are kept.
+ */
+static void resize_block(arena_t *a, void *bp, size_t size, size_t asize)
+{
+    size_t flags = GET(HDRP(bp)) & (PREV_ALLOC | RESERVED);
+    void *rest;
+
+    if (size - asize >= (2 * DSIZE))
+    {
+        PUT(HDRP(bp), PACK(asize, 1 | flags));
+        rest = NEXT_BLKP(bp);
+        PUT(HDRP(rest), PACK(size - asize, PREV_ALLOC));
+        PUT(FTRP(rest), PACK(size - asize, 0));
+        coalesce(a, rest);
+    }
+    else
+    {
+        PUT(HDRP(bp), PACK(size, 1 | flags));
+        SET_PREV_ALLOC(NEXT_BLKP(bp));
+    }
+}
+
+/**
+ * Finds the reservation of the given block (which must have the reserved bit set)
+ */
+static reservation_t *find_reservation(arena_t *a, void *bp)
+{
+    unsigned int offset = TO_OFFSET(bp);
+
+    for (int i = 0; i < RESERVE_SLOTS; i++)
+    {
+        if (a->reservations[i].offset == offset)
+        {
+            return &a->reservations[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Gives the slack of the given reservation back, by splitting off everything
+ * that isn't in use
+ */
+static void trim_reservation(arena_t *a, reservation_t *res)
+{
+    void *bp = FROM_OFFSET(res->offset);
+
+    resize_block(a, bp, GET_SIZE(HDRP(bp)), res->used);
+}
+
+/**
+ * Forgets the reservation of the given block (keeping its slack), which is done
+ * when the block is freed
+ */
+static void drop_reservation(arena_t *a, void *bp)
+{
+    reservation_t *res = find_reservation(a, bp);
+
+    res->offset = 0;
+    PUT(HDRP(bp), GET(HDRP(bp)) & ~RESERVED);
+}
+
+/**
+ * Returns the reservation of the given block, or creates one if it does not have
+ * one yet. When all slots are in use, then the oldest reservation is trimmed and
+ * evicted.
+ */
+static reservation_t *get_reservation(arena_t *a, void *bp)
+{
+    reservation_t *res;
+
+    if (IS_RESERVED(HDRP(bp)))
+    {
+        return find_reservation(a, bp);
+    }
+
+    // Look for an unused slot, and otherwise evict the next one in line
+    if ((res = find_reservation(a, NULL)) == NULL)
+    {
+        res = &a->reservations[a->next_reservation];
+        a->next_reservation = (a->next_reservation + 1) % RESERVE_SLOTS;
+        trim_reservation(a, res);
+        drop_reservation(a, FROM_OFFSET(res->offset));
+    }
+
+    res->offset = TO_OFFSET(bp);
+    res->used = GET_SIZE(HDRP(bp));
+    res->grows = 0;
+    PUT(HDRP(bp), GET(HDRP(bp)) | RESERVED);
+
+    return res;
+}
+
+/**
+ * Gives the slack of every reservation back, returns whether there was any
+ */
+static int reclaim_reservations(arena_t *a)
+{
+    int reclaimed = 0;
+
+    for (int i = 0; i < RESERVE_SLOTS; i++)
+    {
+        if (a->reservations[i].offset != 0 && GET_SIZE(HDRP(FROM_OFFSET(a->reservations[i].offset))) > a->reservations[i].used)
+        {
+            trim_reservation(a, &a->reservations[i]);
+            reclaimed = 1;
+        }
+    }
+
+    return reclaimed;
+}
+
+/**
+ * Computes the slack to reserve for a block of asize bytes that has grown the
+ * given amount of times. The first growth reserves a quarter of the size, and
+ * every growth after that another quarter (up to the size itself).
+ */
+static size_t reserve_slack(size_t asize, unsigned int grows)
+{
+    size_t slack = (asize / 4) * MIN(grows, 4);
+
+    return MIN(slack, RESERVE_MAX) & ~(size_t)(ALIGNMENT - 1);
+}
+
+/**
+ * Returns the distance from the free block at bp to the first payload after it
+ * that is aligned to align bytes, and leaves room for a free block in between
+ */
+static size_t aligned_gap(char *bp, size_t align)
+{
+    char *aligned = (char *)(((size_t)bp + align - 1) & ~(align - 1));
+
+    // Skip ahead if the gap would be too small to be a block of its own
+    if (aligned != bp && aligned - bp < 2 * DSIZE)
+    {
+        aligned += align;
+    }
+
+    return aligned - bp;
+}
+
+// The fast bins are flushed into slabs as well, whose pages are aligned blocks
+static int consolidate(arena_t *a);
+
+/**
+ * Places an allocated block of asize bytes whose payload is aligned to align
+ * bytes (a power of two). The gap in front of the block is split off as a free
+ * block, so it is not wasted.
+ */
+static void *malloc_aligned_block(arena_t *a, size_t asize, size_t align)
+{
+    // A free block of this size always has room for an aligned block, even if the
+    // gap in front of it has to be at least the minimum block size
+    size_t needed = asize + align + 2 * DSIZE;
+    size_t size;
+    size_t gap;
+    unsigned int fresh;
+    char *ptr;
+    char *aligned;
+
+    // The block that would be picked for an ordinary request often happens to
+    // have room for the aligned block as well, which saves splitting a larger one
+    ptr = find_fit(a, asize);
+    if (ptr == NULL || aligned_gap(ptr, align) + asize > GET_SIZE(HDRP(ptr)))
+    {
+        ptr = find_fit(a, needed);
+    }
+
+    // As for any other request, the fast bins are coalesced and the slack of the
+    // reservations is given back before the heap grows
+    if (ptr == NULL && consolidate(a))
+    {
+        ptr = find_fit(a, needed);
+    }
+
+    if (ptr == NULL && reclaim_reservations(a))
+    {
+        ptr = find_fit(a, needed);
+    }
+
+    if (ptr == NULL && (ptr = grow_heap(a, needed)) == NULL)
+    {
+        return NULL;
+    }
+
+    size = GET_SIZE(HDRP(ptr));
+    gap = aligned_gap(ptr, align);
+    aligned = ptr + gap;
+    fresh = IS_FRESH(ptr);
+    remove_free(a, ptr);
+
+    if (gap > 0)
+    {
+        // The gap becomes a free block of its own (which is preceded by an allocated
+        // block, as ptr was free)
+        PUT(HDRP(ptr), PACK(gap, PREV_ALLOC));
+        PUT(FTRP(ptr), PACK(gap, fresh));
+        insert_free(a, ptr);
+        PUT(HDRP(aligned), PACK(size - gap, 1));
+    }
+    else
+    {
+        PUT(HDRP(aligned), PACK(size, 1 | PREV_ALLOC));
+    }
+
+    // Split off the part after the block that isn't needed (which is as fresh as
+    // the block was, since the block was followed by an allocated block)
+    resize_block(a, aligned, size - gap, asize);
+
+    if (fresh && GET_SIZE(HDRP(aligned)) < size - gap)
+    {
+        SET_FRESH(NEXT_BLKP(aligned));
+    }
+
+    return aligned;
+}
+
+/**
+ * Frees the given block, and coalesces it with its neighbours (returns the
+ * resulting free block)
+ */
+static void *free_block(arena_t *a, void *ptr)
+{
+    size_t size = GET_SIZE(HDRP(ptr));
+
+    if (IS_RESERVED(HDRP(ptr)))
+    {
+        drop_reservation(a, ptr);
+    }
+
+    PUT(HDRP(ptr), PACK(size, IS_PREV_ALLOC(HDRP(ptr))));
+    PUT(FTRP(ptr), PACK(size, 0));
+    return coalesce(a, ptr);
+}
+
+/**
+ * Returns whether the given pointer lies in a slab
+ */
+static int is_slab(void *ptr)
+{
+    size_t page = PAGE_INDEX(ptr);
+
+    return page < SLAB_PAGE_WORDS * 32 && (MAP_GET(slab_pages[page / 32]) >> (page % 32)) & 1;
+}
+
+/**
+ * Computes the number of slots in a slab with the given slot size
+ */
+static int slab_slots(size_t slotSize)
+{
+    // (the last word of the page is the header of the next block)
+    return (SLAB_SIZE - WSIZE - SLAB_HDR_SIZE) / slotSize;
+}
+
+/**
+ * Adds the given slab to the front of the list of slabs with free slots
+ */
+static void link_slab(arena_t *a, slab_t *slab, int class)
+{
+    slab_t *head = a->slab_lists[class];
+
+    slab->prev = 0;
+    slab->next = TO_OFFSET(head);
+
+    if (head != NULL)
+    {
+        head->prev = TO_OFFSET(slab);
+    }
+
+    a->slab_lists[class] = slab;
+}
+
+/**
+ * Removes the given slab from the list of slabs with free slots
+ */
+static void unlink_slab(arena_t *a, slab_t *slab, int class)
+{
+    slab_t *prev = FROM_OFFSET(slab->prev);
+    slab_t *next = FROM_OFFSET(slab->next);
+
+    if (prev != NULL)
+    {
+        prev->next = slab->next;
+    }
+    else
+    {
+        a->slab_lists[class] = next;
+    }
+
+    if (next != NULL)
+    {
+        next->prev = slab->prev;
+    }
+}
+
+/**
+ * Creates a new (empty) slab for the given class, returns NULL if there is no
+ * room for it
+ */
+static slab_t *new_slab(arena_t *a, int class)
+{
+    slab_t *slab = malloc_aligned_block(a, SLAB_SIZE, SLAB_SIZE);
+    size_t page;
+    int slots;
+
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    // The page map doesn't cover the rest of the heap, so give the block back
+    page = PAGE_INDEX(slab);
+    if (page >= SLAB_PAGE_WORDS * 32)
+    {
+        free_block(a, slab);
+        return NULL;
+    }
+
+    MAP_SET(slab_pages[page / 32], 1u << (page % 32));
+
+    slab->slotSize = class * ALIGNMENT;
+    slots = slab_slots(slab->slotSize);
+    slab->freeSlots = slots;
+
+    // Mark every slot as free
+    memset(slab->freeMap, 0, sizeof(slab->freeMap));
+    for (int i = 0; i < slots / 32; i++)
+    {
+        slab->freeMap[i] = ~0u;
+    }
+
+    if (slots % 32)
+    {
+        slab->freeMap[slots / 32] = (1u << (slots % 32)) - 1;
+    }
+
+    link_slab(a, slab, class);
+    return slab;
+}
+
+/**
+ * Allocates a slot for the given amount of bytes (at most SLAB_MAX) in a slab
+ */
+static void *slab_malloc(arena_t *a, size_t size)
+{
+    int class = (size + ALIGNMENT - 1) / ALIGNMENT;
+    slab_t *slab = a->slab_lists[class];
+    unsigned int *streak = &a->slab_streaks[adjust_size(size) / ALIGNMENT];
+    int word = 0;
+    int slot;
+
+    // A slab takes a whole page, so a class that only has a few blocks allocated
+    // at a time does without (see end_slab_streak)
+    if (slab == NULL && *streak < SLAB_START)
+    {
+        (*streak)++;
+        return NULL;
+    }
+
+    if (slab == NULL && (slab = new_slab(a, class)) == NULL)
+    {
+        return NULL;
+    }
+
+    // Find the first free slot (the slab is in the list, so there is one)
+    while (slab->freeMap[word] == 0)
+    {
+        word++;
+    }
+
+    slot = word * 32 + __builtin_ctz(slab->freeMap[word]);
+    slab->freeMap[word] &= slab->freeMap[word] - 1;
+
+    if (--slab->freeSlots == 0)
+    {
+        unlink_slab(a, slab, class);
+    }
+
+    return (char *)slab + SLAB_HDR_SIZE + slot * slab->slotSize;
+}
+
+/**
+ * Ends the streak of the size of the given (ordinary) block that is freed, if it
+ * is small enough for a slab
+ */
+static void end_slab_streak(arena_t *a, void *ptr)
+{
+    size_t size = GET_SIZE(HDRP(ptr)) / ALIGNMENT;
+
+    if (size < SLAB_CLASSES + 2)
+    {
+        a->slab_streaks[size] = 0;
+    }
+}
+
+/**
+ * Frees the given slot in its slab. A slab that becomes empty is given back to
+ * the heap, unless it is the only slab of its class with free slots.
+ */
+static void slab_free(arena_t *a, void *ptr)
+{
+    slab_t *slab = SLAB_OF(ptr);
+    int class = slab->slotSize / ALIGNMENT;
+    int slot = ((char *)ptr - (char *)slab - SLAB_HDR_SIZE) / slab->slotSize;
+    size_t page;
+
+    slab->freeMap[slot / 32] |= 1u << (slot % 32);
+
+    if (++slab->freeSlots == 1)
+    {
+        link_slab(a, slab, class);
+    }
+    else if (slab->freeSlots == slab_slots(slab->slotSize) &&
+             (a->slab_lists[class] != slab || slab->next != 0))
+    {
+        unlink_slab(a, slab, class);
+        page = PAGE_INDEX(slab);
+        MAP_CLEAR(slab_pages[page / 32], 1u << (page % 32));
+        free_block(a, slab);
+    }
+}
+
+/**
+ * Computes the length of a mapping for a block of the given size (in whole pages)
+ */
+static size_t map_length(size_t size)
+{
+    return (size + MMAP_OFFSET + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+}
+
+/**
+ * Allocates a block of the given size in a mapping of its own
+ */
+static void *mmap_block(size_t size)
+{
+    size_t length = map_length(size);
+    char *map;
+
+    // The length would overflow
+    if (length < size)
+    {
+        return NULL;
+    }
+
+    LOCK_SBRK();
+    map = mem_map(length);
+    UNLOCK_SBRK();
+
+    if (map == (char *)-1)
+    {
+        return NULL;
+    }
+
+    map += MMAP_OFFSET;
+    MAP_LENGTH(map) = length;
+    PUT(HDRP(map), PACK(0, 1));
+    return map;
+}
+
+/**
+ * Frees a mapped block by unmapping it
+ */
+static void munmap_block(void *bp)
+{
+    LOCK_SBRK();
+    mem_unmap((char *)bp - MMAP_OFFSET, MAP_LENGTH(bp));
+    UNLOCK_SBRK();
+}
+
+/**
+ * Resizes the mapping of a mapped block (which may move it, but never copies
+ * the payload byte by byte)
+ */
+static void *mremap_block(void *bp, size_t size)
+{
+    size_t length = map_length(size);
+    char *map;
+
+    if (length < size)
+    {
+        return NULL;
+    }
+
+    if (length == MAP_LENGTH(bp))
+    {
+        return bp;
+    }
+
+    LOCK_SBRK();
+    map = mem_remap((char *)bp - MMAP_OFFSET, MAP_LENGTH(bp), length);
+    UNLOCK_SBRK();
+
+    if (map == (char *)-1)
+    {
+        return NULL;
+    }
+
+    map += MMAP_OFFSET;
+    MAP_LENGTH(map) = length;
+    return map;
+}
+
+/**
+ * Finds the arena that owns the block (or slot) at the given pointer
+ */
+static arena_t *arena_of(void *ptr)
+{
+#if MM_THREADS
+    return &arenas[arena_map[((char *)ptr - heap_base) / ARENA_CHUNK]];
+#else
+    (void)ptr;
+    return &arenas[0];
+#endif
+}
+
+#if MM_THREADS
+/**
+ * Pushes a list of blocks (or slots) from first to last, linked through NEXT_LINK,
+ * onto the remote free stack of the arena that owns them (with a single CAS)
+ */
+static void remote_free(arena_t *a, void *first, void *last)
+{
+    void *head = __atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED);
+
+    do
+    {
+        NEXT_LINK(last) = head;
+    } while (!__atomic_compare_exchange_n(&a->remote_frees, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+#endif
+
+/**
+ * Sorts a list of blocks (linked through NEXT_LINK) by address, with a merge sort
+ */
+static void *sort_blocks(void *list)
+{
+    void *head = NULL;
+    void **tail = &head;
+    void *slow = list;
+    void *half;
+
+    if (list == NULL || NEXT_LINK(list) == NULL)
+    {
+        return list;
+    }
+
+    // Split the list in the middle
+    for (void *fast = NEXT_LINK(list); fast != NULL && NEXT_LINK(fast) != NULL; fast = NEXT_LINK(NEXT_LINK(fast)))
+    {
+        slow = NEXT_LINK(slow);
+    }
+
+    half = NEXT_LINK(slow);
+    NEXT_LINK(slow) = NULL;
+    list = sort_blocks(list);
+    half = sort_blocks(half);
+
+    while (list != NULL && half != NULL)
+    {
+        void **next = (char *)list < (char *)half ? &list : &half;
+
+        *tail = *next;
+        tail = &NEXT_LINK(*next);
+        *next = *tail;
+    }
+
+    *tail = list != NULL ? list : half;
+    return head;
+}
+
+/**
+ * Frees a list of blocks (or slots) of the given (locked) arena, which is sorted
+ * by address. Runs of blocks that lie next to each other are merged into one
+ * block, which is then coalesced with its neighbours only once.
+ */
+static void free_blocks(arena_t *a, void *list)
+{
+    while (list != NULL)
+    {
+        char *ptr = list;
+        size_t size;
+
+        list = NEXT_LINK(ptr);
+
+        if (is_slab(ptr))
+        {
+            slab_free(a, ptr);
+            continue;
+        }
+
+        end_slab_streak(a, ptr);
+
+        if (IS_RESERVED(HDRP(ptr)))
+        {
+            drop_reservation(a, ptr);
+        }
+
+        // Absorb the blocks right after this one (slots never start right after a block)
+        size = GET_SIZE(HDRP(ptr));
+
+        while (list == ptr + size)
+        {
+            if (IS_RESERVED(HDRP(list)))
+            {
+                drop_reservation(a, list);
+            }
+
+            size += GET_SIZE(HDRP(list));
+            list = NEXT_LINK(list);
+        }
+
+        PUT(HDRP(ptr), PACK(size, IS_PREV_ALLOC(HDRP(ptr))));
+        PUT(FTRP(ptr), PACK(size, 0));
+        coalesce(a, ptr);
+    }
+}
+
+/**
+ * Puts the given (allocated) block in the fast bin of its size if it is small
+ * enough, and returns whether it did. The block stays allocated as far as its
+ * neighbours are concerned, so this touches nothing but the block itself. Blocks
+ * with reserved slack are left to free_block, which has to drop the reservation.
+ */
+static int fastbin_push(arena_t *a, void *ptr)
+{
+    size_t size = GET_SIZE(HDRP(ptr));
+
+    if (size > FASTBIN_MAX || IS_RESERVED(HDRP(ptr)))
+    {
+        return 0;
+    }
+
+    NEXT_LINK(ptr) = a->fastbins[size / ALIGNMENT];
+    a->fastbins[size / ALIGNMENT] = ptr;
+    a->fastbin_bytes += size;
+    return 1;
+}
+
+/**
+ * Takes the last freed block of exactly asize bytes out of its fast bin (or
+ * returns NULL if the bin is empty)
+ */
+static void *fastbin_pop(arena_t *a, size_t asize)
+{
+    void *ptr;
+
+    if (asize > FASTBIN_MAX || (ptr = a->fastbins[asize / ALIGNMENT]) == NULL)
+    {
+        return NULL;
+    }
+
+    a->fastbins[asize / ALIGNMENT] = NEXT_LINK(ptr);
+    a->fastbin_bytes -= asize;
+    return ptr;
+}
+
+/**
+ * Frees all blocks in the fast bins of the given (locked) arena at once (see
+ * free_blocks), and returns whether there were any
+ */
+static int consolidate(arena_t *a)
+{
+    void *list = NULL;
+
+    if (a->fastbin_bytes == 0)
+    {
+        return 0;
+    }
+
+    // Chain the bins together
+    for (int class = 1; class <= FASTBIN_CLASSES; class++)
+    {
+        void *ptr = a->fastbins[class];
+
+        if (ptr == NULL)
+        {
+            continue;
+        }
+
+        while (NEXT_LINK(ptr) != NULL)
+        {
+            ptr = NEXT_LINK(ptr);
+        }
+
+        NEXT_LINK(ptr) = list;
+        list = a->fastbins[class];
+        a->fastbins[class] = NULL;
+    }
+
+    a->fastbin_bytes = 0;
+    free_blocks(a, sort_blocks(list));
+    return 1;
+}
+
+/**
+ * Gives the top of the heap back once a large enough free block has built up
+ * there, returns whether the heap shrunk
+ */
+static int trim_top(arena_t *a)
+{
+    return TRIM_THRESHOLD > 0 && !IS_PREV_ALLOC(HDRP(a->heap_end)) &&
+           GET_SIZE(a->heap_end - DSIZE) >= TRIM_THRESHOLD && trim_heap(a, TRIM_PAD);
+}
+
+#if MM_THREADS
+/**
+ * Frees all blocks on the remote free stack of the given (locked) arena (see
+ * free_blocks), returns whether there were any
+ */
+static int drain_remote_frees(arena_t *a)
+{
+    if (__atomic_load_n(&a->remote_frees, __ATOMIC_RELAXED) == NULL)
+    {
+        return 0;
+    }
+
+    free_blocks(a, sort_blocks(__atomic_exchange_n(&a->remote_frees, NULL, __ATOMIC_ACQUIRE)));
+    return 1;
+}
+
+/**
+ * Drains the remote free stacks of the other arenas that are not locked. An
+ * arena whose threads have exited (or moved on to another arena) is never
+ * locked again, so the blocks that are freed into it would be stranded.
+ */
+static void drain_idle_arenas(arena_t *a)
+{
+    for (arena_t *other = arenas; other < arenas + NUM_ARENAS; other++)
+    {
+        if (other != a && __atomic_load_n(&other->remote_frees, __ATOMIC_RELAXED) != NULL &&
+            pthread_mutex_trylock(&other->lock) == 0)
+        {
+            drain_remote_frees(other);
+            trim_top(other);
+            UNLOCK(other);
+        }
+    }
+}
+#endif
+
+/**
+ * Finds (or makes room for) a free block of at least asize bytes
+ */
+static void *find_block(arena_t *a, size_t asize)
+{
+    char *ptr;
+
+    a->grow_found += asize;
+
+    // Search the free list for a fit (and if there is none, then try again after
+    // coalescing the fast bins, and after giving the slack of the reservations back)
+    ptr = find_fit(a, asize);
+    if (ptr == NULL && consolidate(a))
+    {
+        ptr = find_fit(a, asize);
+    }
+
+    if (ptr == NULL && reclaim_reservations(a))
+    {
+        ptr = find_fit(a, asize);
+    }
+
+#if MM_THREADS
+    // Blocks that other threads have freed since the arena was locked might fit
+    // as well, and before the heap grows, the blocks stranded in idle arenas are
+    // given back (and the top of the heap trimmed if they free it)
+    if (ptr == NULL && drain_remote_frees(a))
+    {
+        ptr = find_fit(a, asize);
+    }
+
+    if (ptr == NULL)
+    {
+        drain_idle_arenas(a);
+    }
+#endif
+
+    // If none, extend the heap to a fitting size
+    if (ptr == NULL)
+    {
+        ptr = grow_heap(a, asize);
+    }
+
+    return ptr;
+}
+
+/**
+ * Finds (or makes room for) a free block of at least asize bytes and places an
+ * allocated block of asize bytes in it (a block of exactly that size in a fast
+ * bin is simply taken)
+ */
+static void *malloc_block(arena_t *a, size_t asize)
+{
+    char *ptr = fastbin_pop(a, asize);
+
+    if (ptr == NULL && (ptr = find_block(a, asize)) != NULL)
+    {
+        place(a, ptr, asize);
+    }
+
+    return ptr;
+}
+
+/**
+ * Locks and returns the arena of the calling thread. A thread is assigned an
+ * arena on its first call, and if its arena is held by another thread, it moves
+ * on to the next arena rather than waiting (so busy arenas shed their threads).
+ * Blocks that other threads have freed in the meantime are freed here.
+ */
+static arena_t *lock_arena(void)
+{
+#if MM_THREADS
+    arena_t *a = thread_arena;
+
+    if (a == NULL)
+    {
+        a = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % NUM_ARENAS];
+    }
+
+    if (pthread_mutex_trylock(&a->lock) != 0)
+    {
+        a = &arenas[(a - arenas + 1) % NUM_ARENAS];
+        LOCK(a);
+    }
+
+    thread_arena = a;
+    drain_remote_frees(a);
+    return a;
+#else
+    return &arenas[0];
+#endif
+}
+
+/**
+ * Allocates a block (or slot) of the given size from the given (locked) arena
+ */
+static void *arena_malloc(arena_t *a, size_t size)
+{
+    void *ptr;
+
+    // Small requests get a slot in a slab (if there is room for one)
+    if (size <= SLAB_MAX && (ptr = slab_malloc(a, size)) != NULL)
+    {
+        return ptr;
+    }
+
+    return malloc_block(a, adjust_size(size));
+}
+
+#if LIFETIME_SITES > 0
+/**
+ * Makes sure that the lifetime predictor of the calling thread belongs to the
+ * current heap
+ */
+static void lifetime_validate(void)
+{
+    if (lifetime.generation != heap_generation)
+    {
+        memset(&lifetime, 0, sizeof(lifetime));
+        lifetime.generation = heap_generation;
+    }
+}
+
+/**
+ * Returns the entry of the given call site in the site table (which is taken
+ * over from the site that held it if they collide)
+ */
+static site_t *lifetime_site(void *site)
+{
+    // The high bits of the product depend on all bits of the address (nearby
+    // call sites only differ in their low bits)
+    site_t *entry = &lifetime.sites[((unsigned int)(size_t)site * 2654435761u >> 16) % LIFETIME_SITES];
+
+    if (entry->site != site)
+    {
+        entry->site = site;
+        entry->shortLived = 0;
+        entry->longLived = 0;
+    }
+
+    return entry;
+}
+
+/**
+ * Returns the slot of the sample of the block at the given pointer
+ */
+static sample_t *lifetime_sample(void *ptr)
+{
+    return &lifetime.samples[((size_t)ptr / ALIGNMENT) % LIFETIME_SAMPLES];
+}
+
+/**
+ * Predicts the lifetime of a block of the given call site, once enough of its
+ * blocks have been sampled to tell
+ */
+static unsigned int lifetime_predict(site_t *entry)
+{
+    if (entry->shortLived + entry->longLived < 4)
+    {
+        return PREDICT_NONE;
+    }
+
+    return entry->shortLived > entry->longLived ? PREDICT_SHORT : PREDICT_LONG;
+}
+
+/**
+ * Records the lifetime of a sampled block with its call site, and whether it
+ * was predicted right. The counts of a site are halved now and then, so that
+ * it follows the recent behaviour of the program.
+ */
+static void lifetime_record(sample_t *sample, int shortLived)
+{
+    site_t *entry = lifetime_site(sample->site);
+
+    if (entry->shortLived + entry->longLived >= 64)
+    {
+        entry->shortLived /= 2;
+        entry->longLived /= 2;
+    }
+
+    if (shortLived)
+    {
+        entry->shortLived++;
+    }
+    else
+    {
+        entry->longLived++;
+    }
+
+    if (sample->prediction != PREDICT_NONE)
+    {
+        lifetime.predicted++;
+        lifetime.correct += (sample->prediction == PREDICT_SHORT) == shortLived;
+    }
+
+    sample->ptr = NULL;
+}
+
+/**
+ * Allocates a block of the given size from the given (locked) arena for the
+ * given call site. Blocks that are predicted to be short-lived are cut from the
+ * top block (if it is large enough), so that they coalesce back into it rather
+ * than leaving holes between long-lived blocks. Every LIFETIME_RATE-th block is
+ * sampled, and a sample that has lived for LIFETIME_SHORT allocations already
+ * is recorded as long-lived once its slot is needed.
+ */
+static void *lifetime_malloc(arena_t *a, size_t size, void *site)
+{
+    site_t *entry;
+    sample_t *sample;
+    unsigned int prediction;
+    void *ptr = NULL;
+
+    lifetime_validate();
+    entry = lifetime_site(site);
+    prediction = lifetime_predict(entry);
+
+    if (prediction == PREDICT_SHORT && size > SLAB_MAX && a->top != NULL &&
+        GET_SIZE(HDRP(a->top)) >= adjust_size(size))
+    {
+        ptr = a->top;
+        place(a, ptr, adjust_size(size));
+    }
+    else
+    {
+        ptr = arena_malloc(a, size);
+    }
+
+    if (ptr == NULL || ++lifetime.clock % LIFETIME_RATE != 0)
+    {
+        return ptr;
+    }
+
+    sample = lifetime_sample(ptr);
+
+    if (sample->ptr != NULL)
+    {
+        if (lifetime.clock - sample->birth <= LIFETIME_SHORT)
+        {
+            return ptr;
+        }
+
+        lifetime_record(sample, 0);
+    }
+
+    sample->ptr = ptr;
+    sample->site = site;
+    sample->birth = lifetime.clock;
+    sample->prediction = prediction;
+    return ptr;
+}
+
+/**
+ * Records the lifetime of the block at the given pointer if it was sampled by
+ * the calling thread (a block that is reallocated is dropped instead)
+ */
+static void lifetime_free(void *ptr, int record)
+{
+    sample_t *sample;
+
+    if (lifetime.generation != heap_generation || (sample = lifetime_sample(ptr))->ptr != ptr)
+    {
+        return;
+    }
+
+    if (record)
+    {
+        lifetime_record(sample, lifetime.clock - sample->birth <= LIFETIME_SHORT);
+    }
+
+    sample->ptr = NULL;
+}
+#endif
+
+/**
+ * Gives the block (or slot) at the given pointer back to its (locked) arena,
+ * and trims the heap if that leaves a large free block at its top (or purges
+ * the pages of a large free block elsewhere). Slots are checked first, as they
+ * have no header. Small blocks are put in a fast bin instead, until the fast
+ * bins hold more than FASTBIN_LIMIT bytes and are coalesced all at once.
+ */
+static void arena_free(arena_t *a, void *ptr)
+{
+    char *bp = NULL;
+    size_t freed = 0;
+
+#if MM_THREADS
+    // The arena is locked anyway, so the blocks that other threads have freed
+    // into it are taken as well (tcache_flush comes through here too)
+    drain_remote_frees(a);
+#endif
+
+    if (is_slab(ptr))
+    {
+        slab_free(a, ptr);
+    }
+    else
+    {
+        end_slab_streak(a, ptr);
+
+        if (!fastbin_push(a, ptr))
+        {
+            freed = GET_SIZE(HDRP(ptr));
+            bp = free_block(a, ptr);
+        }
+        else if (a->fastbin_bytes <= FASTBIN_LIMIT)
+        {
+            return;
+        }
+        else
+        {
+            consolidate(a);
+        }
+    }
+
+    if (trim_top(a))
+    {
+        return;
+    }
+
+    // Otherwise give the pages of a large block back (but keep the header, links
+    // and footer of the free block that it is part of now). Only the block itself
+    // is purged, as its free neighbours were purged when they were freed (if they
+    // were large), so the pages of a free block that small blocks are carved out
+    // of (and given back to) are not purged and faulted back in over and over.
+    if (PURGE_THRESHOLD > 0 && freed >= PURGE_THRESHOLD)
+    {
+        char *lo = MAX((char *)ptr, bp + 3 * WSIZE);
+        char *hi = MIN((char *)ptr + freed, FTRP(bp));
+
+        mem_purge(lo, hi - lo);
+    }
+}
+
+/**
+ * Gives the given amount of blocks from a list of the tcache back to their arenas
+ * (blocks of other arenas than the one of the thread go to their remote free stack)
+ */
+static void tcache_flush(int class, int count)
+{
+    arena_t *locked = NULL;
+    arena_t *a;
+    void *ptr;
+
+    while (count-- > 0 && (ptr = tcache.lists[class]) != NULL)
+    {
+        tcache.lists[class] = NEXT_LINK(ptr);
+        tcache.counts[class]--;
+        a = arena_of(ptr);
+
+#if MM_THREADS
+        if (a != thread_arena)
+        {
+            remote_free(a, ptr, ptr);
+            continue;
+        }
+#endif
+
+        if (a != locked)
+        {
+            if (locked != NULL)
+            {
+                UNLOCK(locked);
+            }
+
+            LOCK(a);
+            locked = a;
+        }
+
+        arena_free(a, ptr);
+    }
+
+    if (locked != NULL)
+    {
+        UNLOCK(locked);
+    }
+}
+
+/**
+ * Empties the whole tcache of the calling thread (as it is about to exit, or
+ * the heap is being trimmed)
+ */
+static void tcache_release(void *unused)
+{
+    (void)unused;
+
+    // A cache from before the heap was reset holds pointers into the old heap
+    if (tcache.generation != heap_generation)
+    {
+        return;
+    }
+
+    for (int class = 1; class <= TCACHE_CLASSES; class++)
+    {
+        tcache_flush(class, tcache.counts[class]);
+    }
+}
+
+/**
+ * Makes sure that the tcache of the calling thread belongs to the current heap
+ */
+static void tcache_validate(void)
+{
+    if (tcache.generation != heap_generation)
+    {
+        memset(&tcache, 0, sizeof(tcache));
+        tcache.generation = heap_generation;
+#if MM_THREADS
+        pthread_setspecific(tcache_key, &tcache);
+#endif
+    }
+}
+
+/**
+ * Pops a block for a request of the given size from the tcache, refilling the
+ * list of the size from the arena of the thread if it is empty
+ */
+static void *tcache_malloc(size_t size)
+{
+    int class = (size + DSIZE - 1) / DSIZE;
+    void *ptr;
+
+    tcache_validate();
+
+    if (tcache.lists[class] == NULL)
+    {
+        arena_t *a = lock_arena();
+
+        for (int i = 0; i < TCACHE_BATCH && (ptr = arena_malloc(a, class * DSIZE)) != NULL; i++)
+        {
+            NEXT_LINK(ptr) = tcache.lists[class];
+            tcache.lists[class] = ptr;
+            tcache.counts[class]++;
+        }
+
+        UNLOCK(a);
+
+        if (tcache.lists[class] == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    ptr = tcache.lists[class];
+    tcache.lists[class] = NEXT_LINK(ptr);
+    tcache.counts[class]--;
+    return ptr;
+}
+
+/**
+ * Pushes the given block onto the list of the given class, making room by
+ * flushing part of the list if it is full
+ */
+static void tcache_push(void *ptr, int class)
+{
+    tcache_validate();
+
+    if (tcache.counts[class] >= TCACHE_COUNT)
+    {
+        tcache_flush(class, TCACHE_BATCH);
+    }
+
+    NEXT_LINK(ptr) = tcache.lists[class];
+    tcache.lists[class] = ptr;
+    tcache.counts[class]++;
+}
+
+/**
+ * Pushes the given block onto the tcache if it is small enough (and returns
+ * whether it did). Blocks with reserved slack are left to the arena, which has
+ * to drop the reservation.
+ */
+static int tcache_free(void *ptr)
+{
+    size_t size;
+    int class;
+
+    if (is_slab(ptr))
+    {
+        size = SLAB_OF(ptr)->slotSize;
+    }
+    else if (IS_RESERVED(HDRP(ptr)))
+    {
+        return 0;
+    }
+    else
+    {
+        size = GET_SIZE(HDRP(ptr)) - WSIZE;
+    }
+
+    // A block is cached by the largest request size that it can serve
+    if ((class = size / DSIZE) > TCACHE_CLASSES)
+    {
+        return 0;
+    }
+
+    tcache_push(ptr, class);
+    return 1;
+}
+
+/**
+ * Diagnostics helper that checks the links, order and priorities of the subtree
+ * rooted at the given node, and returns the number of blocks in it
+ */
+static int check_tree(void *node, void *parent)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+
+    if (PARENT(node) != parent)
+    {
+        printf("Tree node %p has the wrong parent\n", node);
+    }
+
+    if (IS_ALLOC(HDRP(node)) || GET_SIZE(HDRP(node)) < TREE_THRESHOLD)
+    {
+        printf("Tree node %p is allocated or too small (size = %i)\n", node, GET_SIZE(HDRP(node)));
+    }
+
+    if (parent != NULL && tree_priority(node) > tree_priority(parent))
+    {
+        printf("Tree node %p has a higher priority than its parent\n", node);
+    }
+
+    if ((LEFT(node) != NULL && tree_compare(LEFT(node), node) > 0) ||
+        (RIGHT(node) != NULL && tree_compare(RIGHT(node), node) < 0))
+    {
+        printf("Tree node %p has children in the wrong order\n", node);
+    }
+
+    return 1 + check_tree(LEFT(node), node) + check_tree(RIGHT(node), node);
+}
+
+/**
+ * Diagnostics function that checks all blocks in the heap, including the prologue-
+ * block of every segment, but stops at the epilogue block of the last segment
+ */
+int mm_check(void)
+{
+    int blocks = 0;
+    int blocksSize = 0;
+    int free = 0;
+    int freeSize = 0;
+    int notCoalesced = 0;
+    int listed = 0;
+    int slack = 0;
+    int slabs = 0;
+    int slots = 0;
+    int cached = 0;
+
+    char *ptr = heap_listp;
+    arena_t *a;
+
+    while (1)
+    {
+        // At an epilogue, either the heap ends or the next segment starts right after it
+        if (GET_SIZE(HDRP(ptr)) == 0)
+        {
+            if (ptr > (char *)mem_heap_hi())
+            {
+                break;
+            }
+
+            ptr += 2 * WSIZE;
+        }
+
+        // Gather diagnostics regarding the current block
+        char *hp = HDRP(ptr);
+        int size = GET_SIZE(hp);
+        blocks++;
+        blocksSize += size;
+
+        // The next block must know whether this block is allocated
+        if (!IS_ALLOC(hp) != !IS_PREV_ALLOC(HDRP(NEXT_BLKP(ptr))))
+        {
+            printf("Block %p has the wrong prev allocated bit\n", NEXT_BLKP(ptr));
+        }
+
+        if (IS_ALLOC(hp) && IS_RESERVED(hp) && find_reservation(arena_of(ptr), ptr) == NULL)
+        {
+            printf("Block %p has the reserved bit but no reservation\n", ptr);
+        }
+
+        // The number of free slots of a slab must match its bitmap
+        if (IS_ALLOC(hp) && is_slab(ptr))
+        {
+            slab_t *slab = (slab_t *)ptr;
+            int freeSlots = 0;
+
+            for (int i = 0; i < SLAB_MAP_WORDS; i++)
+            {
+                freeSlots += __builtin_popcount(slab->freeMap[i]);
+            }
+
+            if (size != SLAB_SIZE || freeSlots != slab->freeSlots)
+            {
+                printf("Slab %p has %i free slots, but its bitmap has %i\n", ptr, slab->freeSlots, freeSlots);
+            }
+
+            slabs++;
+            slots += slab_slots(slab->slotSize) - freeSlots;
+        }
+
+        if (!IS_ALLOC(hp))
+        {
+            free++;
+            freeSize += size;
+            size_t prev_alloc = IS_PREV_ALLOC(hp);
+            size_t next_alloc = IS_ALLOC(HDRP(NEXT_BLKP(ptr)));
+
+            if (!prev_alloc || !next_alloc)
+            {
+                notCoalesced++;
+            }
+
+            if (GET(hp) != ((GET(FTRP(ptr)) & ~FRESH) | PREV_ALLOC))
+            {
+                printf("Free block %p has a footer that does not match its header\n", ptr);
+            }
+
+            // A fresh block must read as zeros past its links
+            for (char *p = ptr + 3 * WSIZE; IS_FRESH(ptr) && p < FTRP(ptr); p++)
+            {
+                if (*p != 0)
+                {
+                    printf("Fresh block %p has a non-zero byte at %p\n", ptr, p);
+                    break;
+                }
+            }
+        }
+
+        // Move to next block!
+        ptr += size;
+    }
+
+    // Every block in the free list must be free, and every free block must be
+    // in the free list (of the arena that owns it)
+    for (a = arenas; a < arenas + NUM_ARENAS; a++)
+    {
+        for (int bin = 0; bin < NUM_BINS; bin++)
+        {
+            if (BIN_MAPPED(a, bin) != (a->seg_lists[bin] != NULL))
+            {
+                printf("Bitmap bit for bin %i does not match the bin\n", bin);
+            }
+
+            for (ptr = a->seg_lists[bin]; ptr != NULL; ptr = SUCC_FREE(ptr))
+            {
+                listed++;
+
+                if (IS_ALLOC(HDRP(ptr)))
+                {
+                    printf("Allocated block %p found in the free list\n", ptr);
+                }
+
+                if (bin_index(GET_SIZE(HDRP(ptr))) != bin)
+                {
+                    printf("Block %p of size %i is in the wrong bin (%i)\n", ptr, GET_SIZE(HDRP(ptr)), bin);
+                }
+
+                if (arena_of(ptr) != a)
+                {
+                    printf("Block %p is in the free list of the wrong arena\n", ptr);
+                }
+            }
+        }
+
+#if FIT_POLICY == TLSF_FIT
+        for (int fl = 0; fl < TLSF_FL_COUNT; fl++)
+        {
+            if (((a->bin_map >> fl) & 1) != (a->sl_maps[fl] != 0))
+            {
+                printf("Bitmap bit for first level %i does not match its bins\n", fl);
+            }
+        }
+#endif
+
+        listed += check_tree(a->tree_root, NULL);
+
+        // The top block must be the free block before the last epilogue of the arena
+        if (a->top != NULL)
+        {
+            listed++;
+
+            if (IS_ALLOC(HDRP(a->top)) || NEXT_BLKP(a->top) != a->heap_end)
+            {
+                printf("Block %p should not be the top block\n", a->top);
+            }
+        }
+        else if (a->heap_end != NULL && !IS_PREV_ALLOC(HDRP(a->heap_end)))
+        {
+            printf("The free block before %p is not the top block\n", a->heap_end);
+        }
+
+#if MM_THREADS
+        // Every block waiting on a remote free stack must still be allocated
+        for (ptr = a->remote_frees; ptr != NULL; ptr = NEXT_LINK(ptr))
+        {
+            if (arena_of(ptr) != a || (!is_slab(ptr) && !IS_ALLOC(HDRP(ptr))))
+            {
+                printf("Block %p should not be on the remote free stack of arena %i\n", ptr, (int)(a - arenas));
+            }
+        }
+
+#endif
+        // Every block in a fast bin must be allocated, and of the size of the bin
+        size_t fastBytes = 0;
+
+        for (int class = 1; class <= FASTBIN_CLASSES; class++)
+        {
+            for (ptr = a->fastbins[class]; ptr != NULL; ptr = NEXT_LINK(ptr))
+            {
+                if (is_slab(ptr) || !IS_ALLOC(HDRP(ptr)) || GET_SIZE(HDRP(ptr)) != class * ALIGNMENT || arena_of(ptr) != a)
+                {
+                    printf("Block %p should not be in the fast bin of class %i\n", ptr, class);
+                }
+
+                fastBytes += class * ALIGNMENT;
+            }
+        }
+
+        if (fastBytes != a->fastbin_bytes)
+        {
+            printf("Fast bins hold %i bytes, but their count is %i\n", (int)fastBytes, (int)a->fastbin_bytes);
+        }
+
+        // Every slab in a list must have free slots of the size of the list
+        for (int class = 1; class <= SLAB_CLASSES; class++)
+        {
+            for (slab_t *slab = a->slab_lists[class]; slab != NULL; slab = FROM_OFFSET(slab->next))
+            {
+                if (!is_slab(slab) || slab->freeSlots == 0 || slab->slotSize != class * ALIGNMENT)
+                {
+                    printf("Slab %p should not be in the list of class %i\n", (void *)slab, class);
+                }
+            }
+        }
+
+        // Every reservation must belong to an allocated block with the reserved bit
+        for (int i = 0; i < RESERVE_SLOTS; i++)
+        {
+            if (a->reservations[i].offset != 0)
+            {
+                ptr = FROM_OFFSET(a->reservations[i].offset);
+
+                if (!IS_ALLOC(HDRP(ptr)) || !IS_RESERVED(HDRP(ptr)) || GET_SIZE(HDRP(ptr)) < a->reservations[i].used)
+                {
+                    printf("Reservation of block %p does not match its header\n", ptr);
+                }
+
+                slack += GET_SIZE(HDRP(ptr)) - a->reservations[i].used;
+            }
+        }
+    }
+
+    if (listed != free)
+    {
+        printf("Free list contains %i blocks, but %i blocks are free\n", listed, free);
+    }
+
+    // Every block in the tcache of this thread must be allocated (or a slot), and
+    // large enough for its class
+    for (int class = 1; class <= TCACHE_CLASSES && tcache.generation == heap_generation; class++)
+    {
+        int count = 0;
+
+        for (ptr = tcache.lists[class]; ptr != NULL; ptr = NEXT_LINK(ptr))
+        {
+            count++;
+
+            if (!is_slab(ptr) && (!IS_ALLOC(HDRP(ptr)) || (GET_SIZE(HDRP(ptr)) - WSIZE) / DSIZE < class))
+            {
+                printf("Block %p should not be in the tcache list of class %i\n", ptr, class);
+            }
+        }
+
+        if (count != tcache.counts[class])
+        {
+            printf("Tcache list of class %i has %i blocks, but its count is %i\n", class, count, tcache.counts[class]);
+        }
+
+        cached += count;
+    }
+
+    printf("Heapsize: %i bytes. Not using %i bytes\n%i blocks (size = %i), including proglogue in the heap\n%i blocks are free (size = %i)\n%i blocks were not coalesced.\n%i bytes are reserved as realloc slack.\n%i slabs hold %i slots in use.\n%i blocks are cached by this thread.\n\n", (int)mem_heapsize(), (int)(mem_heapsize() - blocksSize), blocks, blocksSize, free, freeSize, notCoalesced, slack, slabs, slots, cached);
+
+#if LIFETIME_SITES > 0
+    if (lifetime.generation == heap_generation)
+    {
+        printf("%u of %u lifetime predictions of this thread were right.\n\n", lifetime.correct, lifetime.predicted);
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+#if MM_THREADS
+    static int initialized = 0;
+
+    if (!initialized)
+    {
+        for (int i = 0; i < NUM_ARENAS; i++)
+        {
+            pthread_mutex_init(&arenas[i].lock, NULL);
+        }
+
+        pthread_key_create(&tcache_key, tcache_release);
+
+        initialized = 1;
+    }
+
+    memset(arena_map, 0, sizeof(arena_map));
+    next_arena = 0;
+    thread_arena = NULL;
+#endif
+
+    heap_base = mem_heap_lo();
+    heap_generation++;
+    memset(slab_pages, 0, sizeof(slab_pages));
+
+    for (arena_t *a = arenas; a < arenas + NUM_ARENAS; a++)
+    {
+        memset(a->seg_lists, 0, sizeof(a->seg_lists));
+        a->bin_map = 0;
+#if FIT_POLICY == TLSF_FIT
+        memset(a->sl_maps, 0, sizeof(a->sl_maps));
+#endif
+#if FIT_POLICY == NEXT_FIT
+        memset(a->rovers, 0, sizeof(a->rovers));
+#endif
+        a->tree_root = NULL;
+        memset(a->reservations, 0, sizeof(a->reservations));
+        a->next_reservation = 0;
+        memset(a->slab_lists, 0, sizeof(a->slab_lists));
+        memset(a->slab_streaks, 0, sizeof(a->slab_streaks));
+        memset(a->fastbins, 0, sizeof(a->fastbins));
+        a->fastbin_bytes = 0;
+        a->heap_end = NULL;
+        a->top = NULL;
+        a->grow_chunk = CHUNKSIZE;
+        a->grow_found = 0;
+#if MM_THREADS
+        a->remote_frees = NULL;
+#endif
+    }
+
+    /* Create the first segment with a free block of CHUNKSIZE bytes, which starts at the bottom of the heap */
+    if (extend_heap(&arenas[0], CHUNKSIZE / WSIZE) == NULL)
+    {
+        return -1;
+    }
+
+    heap_listp = heap_base + (WSIZE * 2);
+
+    return 0;
+}
+
+/*
+ * mm_malloc - Allocate a block by incrementing the brk pointer.
+ *     Always allocate a block whose size is a multiple of the alignment.
+ */
+void *mm_malloc(size_t size)
+{
+    arena_t *a;
+    void *ptr;
+
+    // Ignore irrelevant requests
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    // Large requests get a mapping of their own (as do requests too large for a tag)
+    if ((MMAP_THRESHOLD > 0 && size >= MMAP_THRESHOLD) || IS_HUGE(size))
+    {
+        return mmap_block(size);
+    }
+
+    // Small requests are served by the tcache of the thread without locking
+    if (TCACHE_COUNT > 0 && size <= TCACHE_MAX)
+    {
+        return tcache_malloc(size);
+    }
+
+    a = lock_arena();
+#if LIFETIME_SITES > 0
+    ptr = lifetime_malloc(a, size, __builtin_return_address(0));
+#else
+    ptr = arena_malloc(a, size);
+#endif
+    UNLOCK(a);
+
+    return ptr;
+}
+
+/*
+ * mm_calloc - Allocates a zeroed array of nmemb elements of size bytes. Only
+ *     memory that has been used before is cleared: mappings are fresh from the
+ *     system, and so are blocks that are carved out of a fresh free block (one
+ *     that has not been used since it came from mem_sbrk), apart from the
+ *     words that the free block kept its links and footer in.
+ */
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    arena_t *a;
+    char *ptr;
+    size_t total;
+    int fresh = 0;
+
+    // Ignore irrelevant requests, and requests whose size overflows
+    if (__builtin_mul_overflow(nmemb, size, &total) || total == 0)
+    {
+        return NULL;
+    }
+
+    if ((MMAP_THRESHOLD > 0 && total >= MMAP_THRESHOLD) || IS_HUGE(total))
+    {
+        return mmap_block(total);
+    }
+
+    // Small blocks come from the tcache or a slab, and are cheap to clear
+    if (total <= MAX(TCACHE_MAX, SLAB_MAX))
+    {
+        if ((ptr = mm_malloc(total)) != NULL)
+        {
+            memset(ptr, 0, total);
+        }
+
+        return ptr;
+    }
+
+    a = lock_arena();
+    if ((ptr = fastbin_pop(a, adjust_size(total))) == NULL && (ptr = find_block(a, adjust_size(total))) != NULL)
+    {
+        fresh = place(a, ptr, adjust_size(total));
+    }
+    UNLOCK(a);
+
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
+
+    // The block is ours now, so it is cleared outside of the lock
+    if (fresh)
+    {
+        memset(ptr, 0, 3 * WSIZE);
+        PUT(ptr + GET_SIZE(HDRP(ptr)) - DSIZE, 0);
+    }
+    else
+    {
+        memset(ptr, 0, total);
+    }
+
+    return ptr;
+}
+
+/*
+ * mm_malloc_batch - Allocates n blocks of the given size at once (storing them
+ *     in out), and returns how many could be allocated. The blocks are carved
+ *     out of a single free block in one pass (or come from a slab), all under
+ *     a single lock.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    arena_t *a;
+    size_t asize;
+    size_t count = 0;
+    size_t total;
+    size_t k;
+    size_t fit;
+    char *ptr;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    if ((MMAP_THRESHOLD > 0 && size >= MMAP_THRESHOLD) || IS_HUGE(size))
+    {
+        while (count < n && (out[count] = mmap_block(size)) != NULL)
+        {
+            count++;
+        }
+
+        return count;
+    }
+
+    a = lock_arena();
+
+    if (size <= SLAB_MAX)
+    {
+        while (count < n && (out[count] = slab_malloc(a, size)) != NULL)
+        {
+            count++;
+        }
+    }
+
+    asize = adjust_size(size);
+
+    while (count < n)
+    {
+        k = MAX(1, MIN(n - count, BATCH_MAX / asize));
+
+        // Rather carve fewer blocks at a time out of the free blocks there are,
+        // than grow the heap for the whole batch
+        for (fit = k; (ptr = find_fit(a, fit * asize)) == NULL && fit > 1;)
+        {
+            fit = (fit + 1) / 2;
+        }
+
+        if (ptr != NULL)
+        {
+            k = fit;
+        }
+        else if ((ptr = find_block(a, k * asize)) == NULL)
+        {
+            break;
+        }
+
+        // Place one block for the whole batch, and cut it up (the last block gets
+        // whatever was too small to split off)
+        place(a, ptr, k * asize);
+        total = GET_SIZE(HDRP(ptr));
+
+        for (size_t i = 0; i < k; i++)
+        {
+            size_t bsize = i < k - 1 ? asize : total - (k - 1) * asize;
+
+            PUT(HDRP(ptr), PACK(bsize, 1 | PREV_ALLOC));
+            out[count++] = ptr;
+            ptr += bsize;
+        }
+    }
+
+    UNLOCK(a);
+    return count;
+}
+
+/*
+ * Frees the block at the given pointer, by flipping the allocated fields to 0
+ * and afterwards attempts to coalesce the prev and next block. Small blocks are
+ * kept in the tcache of the thread instead, and others are always given back
+ * to the arena that they were allocated from (through its remote free stack if
+ * it is not the arena of the thread). Mapped blocks are unmapped.
+ */
+void mm_free(void *ptr)
+{
+    arena_t *a;
+
+    // Mapped blocks are simply unmapped (slots have no header, so they are ruled out first)
+    if (!is_slab(ptr) && IS_MMAPPED(ptr))
+    {
+        munmap_block(ptr);
+        return;
+    }
+
+    if (TCACHE_COUNT > 0 && tcache_free(ptr))
+    {
+        return;
+    }
+
+#if LIFETIME_SITES > 0
+    lifetime_free(ptr, 1);
+#endif
+
+    a = arena_of(ptr);
+
+#if MM_THREADS
+    // Blocks of another arena are left for that arena to free
+    if (a != thread_arena)
+    {
+        remote_free(a, ptr, ptr);
+        return;
+    }
+#endif
+
+    LOCK(a);
+    arena_free(a, ptr);
+    UNLOCK(a);
+}
+
+/*
+ * mm_free_sized - Frees a block that was allocated by mm_malloc (or mm_calloc)
+ *     with the given size. Small blocks go straight to the tcache list of that
+ *     size, without loading their header (or slab) at all: mm_malloc serves a
+ *     request from the same list, so the block is large enough for any request
+ *     that the list serves. Blocks that were resized by mm_realloc, or that came
+ *     from mm_memalign or mm_malloc_batch, must be freed with mm_free.
+ */
+void mm_free_sized(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    if (TCACHE_COUNT > 0 && size > 0 && size <= TCACHE_MAX && !(MMAP_THRESHOLD > 0 && size >= MMAP_THRESHOLD))
+    {
+        tcache_push(ptr, (size + DSIZE - 1) / DSIZE);
+        return;
+    }
+
+    mm_free(ptr);
+}
+
+/*
+ * mm_free_batch - Frees n blocks at once (NULL pointers are skipped). The blocks
+ *     of every arena are sorted by address and freed in a single sweep under a
+ *     single lock, which merges blocks that lie next to each other before they
+ *     are coalesced (see free_blocks). Blocks of another arena than the one of
+ *     the thread are pushed onto its remote free stack all at once.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    void *lists[NUM_ARENAS] = {NULL};
+    arena_t *a;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        void *ptr = ptrs[i];
+
+        if (ptr == NULL)
+        {
+            continue;
+        }
+
+        if (!is_slab(ptr) && IS_MMAPPED(ptr))
+        {
+            munmap_block(ptr);
+            continue;
+        }
+
+#if LIFETIME_SITES > 0
+        lifetime_free(ptr, 1);
+#endif
+
+        a = arena_of(ptr);
+        NEXT_LINK(ptr) = lists[a - arenas];
+        lists[a - arenas] = ptr;
+    }
+
+    for (a = arenas; a < arenas + NUM_ARENAS; a++)
+    {
+        void *list = sort_blocks(lists[a - arenas]);
+
+        if (list == NULL)
+        {
+            continue;
+        }
+
+#if MM_THREADS
+        if (a != thread_arena)
+        {
+            void *last = list;
+
+            while (NEXT_LINK(last) != NULL)
+            {
+                last = NEXT_LINK(last);
+            }
+
+            remote_free(a, list, last);
+            continue;
+        }
+#endif
+
+        LOCK(a);
+        free_blocks(a, list);
+        trim_top(a);
+        UNLOCK(a);
+    }
+}
+
+/*
+ * Resizes the block in place whenever possible, and otherwise falls back to
+ * malloc, memcpy and free (all within the arena that owns the block).
+ *
+ * A block can shrink by splitting off its tail, and grow by absorbing a free next
+ * and/or previous block (in which case the payload is moved down). If the block
+ * is the last one in the heap (possibly followed by a free block), the heap is
+ * extended by exactly the missing amount, so a buffer that is grown repeatedly
+ * at the end of the heap is never copied.
+ *
+ * Every block that grows gets a reservation, and is given slack on top of the
+ * requested size (as far as its neighbours allow), so that the next few times it
+ * grows it already has room for the new size.
+ */
+static void *arena_realloc(arena_t *a, void *ptr, size_t size)
+{
+    void *newPtr;
+    void *next;
+    reservation_t *res;
+    size_t asize;
+    size_t target;
+    size_t oldSize;
+    size_t copySize;
+    size_t available;
+    size_t nextSize = 0;
+    size_t prevSize = 0;
+
+    // A slot cannot grow, so it has to be moved if it doesn't fit anymore
+    if (is_slab(ptr))
+    {
+        oldSize = SLAB_OF(ptr)->slotSize;
+
+        if (size <= oldSize)
+        {
+            return ptr;
+        }
+
+        if ((newPtr = arena_malloc(a, size)) == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(newPtr, ptr, oldSize);
+        slab_free(a, ptr);
+        return newPtr;
+    }
+
+    asize = adjust_size(size);
+    oldSize = GET_SIZE(HDRP(ptr));
+    res = IS_RESERVED(HDRP(ptr)) ? find_reservation(a, ptr) : NULL;
+
+    // If the block is already large enough, then a growing block just uses some of
+    // its slack, and otherwise we split off whatever isn't needed anymore
+    if (asize <= oldSize)
+    {
+        if (res == NULL || asize < res->used)
+        {
+            resize_block(a, ptr, oldSize, asize);
+        }
+
+        if (res != NULL)
+        {
+            res->used = asize;
+        }
+
+        return ptr;
+    }
+
+    // The block has to grow, so remember that and figure out how much slack to give
+    // it (only the part that is in use has to be copied if the block moves)
+    res = get_reservation(a, ptr);
+    res->grows++;
+    copySize = res->used - WSIZE;
+    target = asize + reserve_slack(asize, res->grows);
+
+    next = NEXT_BLKP(ptr);
+
+    if (!IS_ALLOC(HDRP(next)))
+    {
+        nextSize = GET_SIZE(HDRP(next));
+    }
+
+    // If the block is at the end of the heap (only followed by a free block or the
+    // epilogue), then extend the heap by the amount missing (but at least by the
+    // minimum block size), which coalesces with the free block after ours (if any)
+    if (GET_SIZE(HDRP(next)) == 0 || (nextSize > 0 && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))
+    {
+        if (oldSize + nextSize < target)
+        {
+            if ((next = extend_heap(a, MAX(target - oldSize - nextSize, 2 * DSIZE) / WSIZE)) == NULL)
+            {
+                return NULL;
+            }
+
+            // Another arena may own the top of the heap, in which case the new
+            // memory went to a segment of its own (that we cannot grow into)
+            next = NEXT_BLKP(ptr);
+            nextSize = IS_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+        }
+    }
+
+    // Grow into the next block if it is free and large enough
+    if (oldSize + nextSize >= asize)
+    {
+        remove_free(a, next);
+        resize_block(a, ptr, oldSize + nextSize, MIN(oldSize + nextSize, target));
+        res->used = asize;
+        return ptr;
+    }
+
+    if (!IS_PREV_ALLOC(HDRP(ptr)))
+    {
+        prevSize = GET_SIZE(HDRP(PREV_BLKP(ptr)));
+    }
+
+    // Otherwise grow into the previous block (and the next if it is free), and
+    // move the payload down to the start of the previous block
+    available = prevSize + oldSize + nextSize;
+
+    if (prevSize > 0 && available >= asize)
+    {
+        newPtr = PREV_BLKP(ptr);
+        remove_free(a, newPtr);
+
+        if (nextSize > 0)
+        {
+            remove_free(a, next);
+        }
+
+        memmove(newPtr, ptr, copySize);
+        resize_block(a, newPtr, available, MIN(available, target));
+        PUT(HDRP(newPtr), GET(HDRP(newPtr)) | RESERVED);
+        res->offset = TO_OFFSET(newPtr);
+        res->used = asize;
+        return newPtr;
+    }
+
+    // Large blocks that have to move anyway move to a mapping of their own (from
+    // where they can grow without being copied)
+    if (MMAP_THRESHOLD > 0 && size >= MMAP_THRESHOLD && (newPtr = mmap_block(size)) != NULL)
+    {
+        memcpy(newPtr, ptr, copySize);
+        free_block(a, ptr);
+        return newPtr;
+    }
+
+    // As a last resort move the block (preferably with slack), note that malloc
+    // might trim our block down to the part that is in use. The new block must
+    // have a header for the reservation, so it never comes from a slab
+    if ((newPtr = malloc_block(a, adjust_size(target - WSIZE))) == NULL &&
+        (newPtr = malloc_block(a, adjust_size(size))) == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(newPtr, ptr, copySize);
+
+    // The reservation follows the block to its new location
+    PUT(HDRP(ptr), GET(HDRP(ptr)) & ~RESERVED);
+    free_block(a, ptr);
+    PUT(HDRP(newPtr), GET(HDRP(newPtr)) | RESERVED);
+    res->offset = TO_OFFSET(newPtr);
+    res->used = asize;
+    return newPtr;
+}
+
+/*
+ * mm_realloc - Resizes the block at the given pointer (see arena_realloc)
+ */
 void *mm_realloc(void *ptr, size_t size)
 {
+    arena_t *a;
     void *newPtr;
-    if ((newPtr = mm_malloc(size)) == NULL)
+
+    if (ptr == NULL)
+    {
+        return mm_malloc(size);
+    }
+
+    if (size == 0)
     {
+        mm_free(ptr);
         return NULL;
     }
 
-    size_t copySize = GET_SIZE(HDRP(ptr)) - DSIZE;
+    // Mapped blocks are resized by remapping them
+    if (!is_slab(ptr) && IS_MMAPPED(ptr))
+    {
+        return mremap_block(ptr, size);
+    }
 
-    // If we're shrinking, make sure we don't copy
-    // more than necessary to avoid errors
-    if (size < copySize)
+    // A block that grows too large for a tag has to move to a mapping
+    if (IS_HUGE(size))
     {
-        copySize = size;
+        if ((newPtr = mmap_block(size)) == NULL)
+        {
+            return NULL;
+        }
+
+        memcpy(newPtr, ptr, is_slab(ptr) ? SLAB_OF(ptr)->slotSize : GET_SIZE(HDRP(ptr)) - WSIZE);
+        mm_free(ptr);
+        return newPtr;
     }
 
-    memcpy(newPtr, ptr, copySize);
-    mm_free(ptr);
+#if LIFETIME_SITES > 0
+    lifetime_free(ptr, 0);
+#endif
+
+    a = arena_of(ptr);
+    LOCK(a);
+    newPtr = arena_realloc(a, ptr, size);
+    UNLOCK(a);
+
     return newPtr;
 }
+
+/*
+ * mm_memalign - Allocates a block whose payload is aligned to the given
+ *     alignment (a power of two). Alignments up to ALIGNMENT are met by every
+ *     block, and larger ones are served from the heap by splitting off the gap
+ *     in front of the block as a free block (see malloc_aligned_block).
+ */
+void *mm_memalign(size_t align, size_t size)
+{
+    arena_t *a;
+    void *ptr;
+
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        return NULL;
+    }
+
+    if (align <= ALIGNMENT)
+    {
+        return mm_malloc(size);
+    }
+
+    // Ignore irrelevant requests, and requests that could not fit in a tag with
+    // their gap
+    if (size == 0 || IS_HUGE(size) || IS_HUGE(adjust_size(size) + align + 2 * DSIZE))
+    {
+        return NULL;
+    }
+
+    a = lock_arena();
+    ptr = malloc_aligned_block(a, adjust_size(size), align);
+    UNLOCK(a);
+
+    return ptr;
+}
+
+/*
+ * mm_aligned_alloc - Allocates an aligned block (as in C11, see mm_memalign)
+ */
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+    return mm_memalign(align, size);
+}
+
+/*
+ * mm_posix_memalign - Allocates an aligned block (see mm_memalign), and stores
+ *     it at memptr. Returns EINVAL if the alignment is not a power of two
+ *     multiple of sizeof(void *), and ENOMEM if there is no room for the block.
+ */
+int mm_posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *ptr;
+
+    if (align == 0 || align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+    {
+        return EINVAL;
+    }
+
+    if ((ptr = mm_memalign(align, size)) == NULL && size != 0)
+    {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+    return 0;
+}
+
+/*
+ * mm_trim - Gives the free memory at the top of the heap back to the system,
+ *     except for pad bytes. The blocks cached by the calling thread (and the
+ *     blocks waiting to be freed by other threads, and the blocks in the fast
+ *     bins) are freed first. Returns 1
+ *     if the heap shrunk, and 0 otherwise.
+ */
+int mm_trim(size_t pad)
+{
+    int trimmed = 0;
+
+    if (TCACHE_COUNT > 0)
+    {
+        tcache_validate();
+        tcache_release(NULL);
+    }
+
+    for (arena_t *a = arenas; a < arenas + NUM_ARENAS; a++)
+    {
+        if (a->heap_end == NULL)
+        {
+            continue;
+        }
+
+        LOCK(a);
+#if MM_THREADS
+        drain_remote_frees(a);
+#endif
+        consolidate(a);
+        trimmed |= trim_heap(a, pad);
+        UNLOCK(a);
+    }
+
+    return trimmed;
+}
+
+/*
+ * mm_predictions - Returns how many of the lifetime predictions of the calling
+ *     thread have been checked (once the sampled blocks were freed) since
+ *     mm_init, and stores how many of them were right in right. Both are 0
+ *     without LIFETIME_SITES.
+ */
+unsigned int mm_predictions(unsigned int *right)
+{
+#if LIFETIME_SITES > 0
+    if (lifetime.generation == heap_generation)
+    {
+        *right = lifetime.correct;
+        return lifetime.predicted;
+    }
+#endif
+
+    *right = 0;
+    return 0;
+}
+
+/**
+ * The interface of this build, named after its placement policy
+ */
+const mm_ops_t mm_ops = {
+    FIT_POLICY_NAME,
+    mm_init,
+    mm_malloc,
+    mm_free,
+    mm_free_sized,
+    mm_calloc,
+    mm_realloc,
+    mm_memalign,
+    mm_malloc_batch,
+    mm_free_batch,
+    mm_trim,
+    mm_predictions,
+};
@@ -1,9 +1,65 @@
 #include <stdio.h>
 
+/*
+ * Compiling mm.c with -DMM_PREFIX=x_ renames everything that it exports
+ * (to x_mm_init, x_mm_malloc, ..., x_mm_ops and x_team), so that builds
+ * with different compile-time policies can be linked into one program.
+ */
+#ifdef MM_PREFIX
+#define MM_CONCAT(prefix, name) prefix##name
+#define MM_NAME(prefix, name) MM_CONCAT(prefix, name)
+#define mm_init MM_NAME(MM_PREFIX, mm_init)
+#define mm_malloc MM_NAME(MM_PREFIX, mm_malloc)
+#define mm_free MM_NAME(MM_PREFIX, mm_free)
+#define mm_free_sized MM_NAME(MM_PREFIX, mm_free_sized)
+#define mm_calloc MM_NAME(MM_PREFIX, mm_calloc)
+#define mm_realloc MM_NAME(MM_PREFIX, mm_realloc)
+#define mm_trim MM_NAME(MM_PREFIX, mm_trim)
+#define mm_predictions MM_NAME(MM_PREFIX, mm_predictions)
+#define mm_malloc_batch MM_NAME(MM_PREFIX, mm_malloc_batch)
+#define mm_free_batch MM_NAME(MM_PREFIX, mm_free_batch)
+#define mm_memalign MM_NAME(MM_PREFIX, mm_memalign)
+#define mm_aligned_alloc MM_NAME(MM_PREFIX, mm_aligned_alloc)
+#define mm_posix_memalign MM_NAME(MM_PREFIX, mm_posix_memalign)
+#define mm_check MM_NAME(MM_PREFIX, mm_check)
+#define mm_ops MM_NAME(MM_PREFIX, mm_ops)
+#define team MM_NAME(MM_PREFIX, team)
+#endif
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_trim(size_t pad);
+extern unsigned int mm_predictions(unsigned int *right);
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+extern void mm_free_batch(void **ptrs, size_t n);
+extern void *mm_memalign(size_t align, size_t size);
+extern void *mm_aligned_alloc(size_t align, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t align, size_t size);
+
+/* 
+ * The interface of one build of the allocator, which lets a program
+ * pick between several builds at run time.
+ */
+typedef struct {
+    const char *name;  /* the placement policy of the build */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void (*free_sized)(void *ptr, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*memalign)(size_t align, size_t size);
+    size_t (*malloc_batch)(size_t size, size_t n, void **out);
+    void (*free_batch)(void **ptrs, size_t n);
+    int (*trim)(size_t pad);
+    unsigned int (*predictions)(unsigned int *right);
+} mm_ops_t;
+
+extern const mm_ops_t mm_ops;
 
 
 /* 
@@ -5,6 +5,14 @@ LOCAL="./"
 SUBDIR="malloclab-handout"
 FILE="mm.c"
 
+# mem_sbrk can shrink the heap (and mdriver measures the peak heap size), so the
+# remote memlib and driver have to match ours
+LIBS="memlib.h $SUBDIR/memlib.c $SUBDIR/mdriver.c mm.h"
+
 scp $LOCAL/$FILE cos.itu.dk:~/$SUBDIR/$FILE
 
+for LIB in $LIBS; do
+    scp $LOCAL/$LIB cos.itu.dk:~/$SUBDIR/$(basename $LIB)
+done
+
 ssh cos.itu.dk "cd $SUBDIR; make; ./mdriver; exit"
\ No newline at end of file